@@ -0,0 +1,97 @@
+#pragma once
+// Momentary buttons, the action CV input and the encoder - a timer interrupt reads all the button pins from the port registers every millisecond
+// Each button is debounced by requiring a changed reading to hold for several scans, then press, release and long press events are put on the input bus
+// with the time the change was first read so a slow display frame delays the response to a press but never loses it
+#include <Encoder.h>
+#include "Settings.h"
+#include "InputHandler.h"
+
+extern Btn btns[];
+extern Encoder myEnc;
+extern InputHandler inputs;
+
+class ButtonHandler {
+public:
+	void begin();							// set up the button pins and encoder position - call from setup() before starting the button timer
+	void scan();							// read and debounce all buttons and the encoder, putting any changes on the input bus - called from the button timer interrupt
+	boolean held(uint8_t b) { return (heldMask >> b) & 1; }		// debounced state of btns[b]
+
+	static const uint8_t count = 6;
+	static const uint16_t scanInterval = 1000;		// microseconds between scans
+
+private:
+	uint8_t readPins();
+
+	static const uint8_t debounceScans = 4;			// scans a changed reading must hold for before it is accepted
+	static const uint16_t longPressScans = 500;		// scans a button must be held for a long press
+
+	volatile uint8_t heldMask;				// bit set for each button down after debouncing
+	uint8_t settle[count];					// scans the reading has differed from the debounced state
+	uint32_t changed[count];				// time the reading first differed
+	uint16_t heldScans[count];				// scans since the button was pressed - stops counting at a long press
+	long detent;							// encoder position in detents
+	int8_t turned;							// detents turned that have not yet fitted on the input bus
+};
+
+void ButtonHandler::begin() {
+	for (uint8_t b = 0; b < count; b++) {
+		pinMode(btns[b].pin, INPUT_PULLUP);
+	}
+	detent = myEnc.read() / 4;
+}
+
+void ButtonHandler::scan() {
+	uint32_t now = micros();
+	uint8_t down = readPins();
+	for (uint8_t b = 0; b < count; b++) {
+		boolean isDown = (down >> b) & 1;
+		if (isDown != held(b)) {
+			if (settle[b]++ == 0) {
+				changed[b] = now;
+			}
+			if (settle[b] >= debounceScans) {
+				settle[b] = 0;
+				heldScans[b] = 0;
+				heldMask ^= 1 << b;
+				inputs.push(LANEPANEL, isDown ? INPUTPRESS : INPUTRELEASE, b, 0, changed[b]);
+			}
+		}
+		else {
+			//	a bounce back to the debounced state starts the count again
+			settle[b] = 0;
+			if (isDown && heldScans[b] < longPressScans && ++heldScans[b] == longPressScans) {
+				inputs.push(LANEPANEL, INPUTLONG, b, 0, now);
+			}
+		}
+	}
+
+	//	the encoder is counted by its own pin interrupts - four counts to a detent
+	long d = myEnc.read() / 4;
+	if (d != detent) {
+		turned = constrain(turned + d - detent, -100, 100);
+		detent = d;
+	}
+	//	turns are held back while the lane is nearly full so there is always room for a press and release of every button
+	if (turned != 0 && inputs.space(LANEPANEL) > count * 2 && inputs.push(LANEPANEL, INPUTENCODER, 0, turned, now)) {
+		turned = 0;
+	}
+}
+
+uint8_t ButtonHandler::readPins() {
+	//	bit b is set while btns[b] is down - the buttons pull their pins low
+#if defined(KINETISK)
+	//	one read of each port so buttons pressed together are seen in the same scan - pins 22, 12 and 15 are on port C, 19 on port B, 20 and 21 on port D
+	uint32_t portB = GPIOB_PDIR;
+	uint32_t portC = GPIOC_PDIR;
+	uint32_t portD = GPIOD_PDIR;
+	uint8_t up = ((portC & CORE_PIN22_BITMASK) ? 1 : 0) | ((portC & CORE_PIN12_BITMASK) ? 2 : 0) | ((portC & CORE_PIN15_BITMASK) ? 4 : 0)
+		| ((portB & CORE_PIN19_BITMASK) ? 8 : 0) | ((portD & CORE_PIN20_BITMASK) ? 16 : 0) | ((portD & CORE_PIN21_BITMASK) ? 32 : 0);
+	return ~up & 0x3F;
+#else
+	uint8_t down = 0;
+	for (uint8_t b = 0; b < count; b++) {
+		down |= (digitalRead(btns[b].pin) == 0) << b;
+	}
+	return down;
+#endif
+}
@@ -0,0 +1,79 @@
+#pragma once
+// Multi-point DAC calibration - a measured offset at each volt from 0V to 5V is expanded into a correction table covering every DAC code
+#include "Settings.h"
+
+class CalibrationHandler {
+public:
+	static const uint8_t calibPoints = 6;		// one calibration point per volt: 0V, 1V ... 5V
+
+	int16_t offset[calibPoints];	// DAC count offset needed at each calibration point to output the exact voltage
+	int8_t activePoint = -1;		// calibration point currently being adjusted in the setup menu (-1 if not calibrating)
+
+	CalibrationHandler() {
+		reset(0);
+	};
+
+	void reset(int16_t o);			// set all calibration points to the same offset (eg when upgrading from single offset calibration)
+	void buildTable();				// expand calibration points into the correction table - call after loading or editing offsets
+	uint16_t dacCode(float volts);	// returns the corrected DAC code for a voltage in the 0-5V range
+	uint16_t correct(uint16_t code) { return table[code]; }
+	void startCalibration();		// begin guided calibration at 0V
+	boolean nextPoint();			// move to the next calibration point - returns false once all points have been set
+	void adjustPoint(int8_t amt);	// alter the offset of the point currently being calibrated
+	void outputPoint();				// output the voltage of the point currently being calibrated
+	String pointDescription();		// eg '2V +5' for display in the setup menu
+
+private:
+	uint16_t table[4096];			// corrected DAC code for every uncorrected DAC code
+};
+
+void CalibrationHandler::reset(int16_t o) {
+	for (uint8_t p = 0; p < calibPoints; p++) {
+		offset[p] = o;
+	}
+	buildTable();
+}
+
+void CalibrationHandler::buildTable() {
+	// linearly interpolate the offset between the calibration points either side of each DAC code
+	for (uint16_t c = 0; c < 4096; c++) {
+		uint8_t p = min(c / DACVOLT, calibPoints - 2);
+		int32_t corrected = c + offset[p] + ((int32_t)(offset[p + 1] - offset[p]) * (int32_t)(c - p * DACVOLT)) / (int32_t)DACVOLT;
+		table[c] = constrain(corrected, 0, 4095);
+	}
+}
+
+uint16_t CalibrationHandler::dacCode(float volts) {
+	//  DAC buffer takes values of 0 to 4095 relating to 0v to 3.3v (amplified to 0 - 5v)
+	return table[VoltsToCode(volts)];
+}
+
+void CalibrationHandler::startCalibration() {
+	activePoint = 0;
+	outputPoint();
+}
+
+boolean CalibrationHandler::nextPoint() {
+	if (++activePoint < calibPoints) {
+		outputPoint();
+		return 1;
+	}
+	activePoint = -1;
+	buildTable();
+	return 0;
+}
+
+void CalibrationHandler::adjustPoint(int8_t amt) {
+	if (activePoint >= 0) {
+		offset[activePoint] = constrain(offset[activePoint] + amt, -400, 400);
+		outputPoint();
+	}
+}
+
+void CalibrationHandler::outputPoint() {
+	analogWrite(DACPIN, constrain(activePoint * DACVOLT + offset[activePoint], 0, 4095));
+}
+
+String CalibrationHandler::pointDescription() {
+	return String(activePoint) + "V " + (offset[activePoint] > 0 ? "+" : "") + String(offset[activePoint]);
+}
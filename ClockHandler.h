@@ -1,8 +1,11 @@
-// Code to manage external clock reading - Eurorack clock fires 16 5V pulses per bar
+#pragma once
+// Code to manage external clock reading - pulses are captured by a pin interrupt and the pulses per quarter note (PPQN) of the clock source is configurable
+// USB-MIDI clock pulses feed the same tracker at 24 PPQN - the source already running is followed until it stops
 #include "Settings.h"
+#include "InputHandler.h"
 
 extern float bpm;
-extern elapsedMillis timeCounter;
+extern InputHandler inputs;
 
 class ClockHandler {
 public:
@@ -15,17 +18,25 @@ public:
 	float clockBPM = 0;				// BPM read from external clock
 	uint32_t clockHighTime = 0;		// time in milliseconds of last clock signal (eg for timing pulses and display)
 	uint32_t clockInterval = 0;		// time in milliseconds of current clock interval
+	uint8_t pulses = 0;				// number of new clock pulses detected by the last readClock()
+	uint32_t pulseMicros = 0;		// time in microseconds of last clock pulse
+	uint8_t ppqn = 4;				// clock pin pulses per quarter note - Eurorack clocks commonly fire 16 pulses per bar
+	uint8_t pulsePPQN() { return source == SOURCEMIDI ? MIDIPPQN : ppqn; }	// pulses per quarter note of the clock being followed
 	boolean hasSignal();			// returns true if a clock signal is detected and within sensible limits
-	float readClock();				// reads the clock pin and calculates BPM if clock signal found
+	float readClock();				// checks for new clock pulses and calculates BPM if clock signal found
+	boolean onPulse(uint32_t t, clockSource src);	// pulse at time t from the clock pin interrupt or MIDI clock - returns false if the pulse is a bounce or another source is running
+	void countPulse(uint32_t t);	// clock event taken from the input bus by loop() - counted by the next readClock()
 	void printDebug();				// prints debug information to the serial monitor
 
 private:
 	int minBPM = 35;				// minimum BPM allowed for internal/external clock
 	int maxBPM = 300;				// maximum BPM allowed for internal/external clock
 	boolean clockSignal = 0;		// 1 = External clock is sending currently sending pulses
+	volatile clockSource source = SOURCEPIN;
 	int clockInput = 0;				// voltage reading of clock inpu pin translated to 0-1023 range (0-3.3V)
-	boolean clockHigh = 0;			// Set to 1 if clock is above threshold
-	uint32_t lastClockHigh = 0;		// time in milliseconds since clock last high to check for bounce
+	volatile uint32_t isrMicros = 0;	// time of last pulse accepted by the interrupt
+	uint8_t newPulses = 0;			// pulses taken from the input bus since the last readClock()
+	uint32_t newPulseMicros = 0;	// time of the last of them
 	uint32_t lastGoodBPM = 0;		// time in milliseconds since we got a valid BPM reading to allow brief dropouts to be handled
 	float testClockBPM = 0;			// Provisional BPM read from external clock - may not be used for actual clock if signal intermittant
 	static const int avStepsBMP = 5;// TODO - number of previous reads to average
@@ -33,29 +44,46 @@ private:
 	int counterPrevBPM = 0;			// TODO - iterates through BPM averager
 };
 
-float ClockHandler::readClock() {
+boolean ClockHandler::onPulse(uint32_t t, clockSource src) {
+	//	the other source takes over once the one being followed has stopped for a second
+	if (src != source) {
+		if (isrMicros > 0 && t - isrMicros < 1000000) {
+			return 0;
+		}
+		source = src;
+	}
 
-	if (!digitalRead(CLOCKPIN)) {
+	// clock input is inverted so pulses are falling edges - ignore bounces faster than twice the maximum BPM at the current PPQN
+	if (t - isrMicros > (uint32_t)(30000000 / (maxBPM * pulsePPQN()))) {
+		isrMicros = t;
+		inputs.push(src == SOURCEPIN ? LANECLOCKPIN : LANESEQTIMER, INPUTCLOCK, src, 0, t);
+		return 1;
+	}
+	return 0;
+}
 
-		// check if a new clock pulse has been detected - previous state low and no high clock in the last 20 milliseconds ( && millis() - lastClockHigh > 20 last test causing some false readings so maybe ditch)
-		if (clockHigh == 0 && millis() - clockHighTime > 20) {
-			//	Eurorack clock fires 16 5V pulses per bar
-			clockInterval = millis() - clockHighTime;
-			testClockBPM = (float)(1 / (((double)(millis() - clockHighTime) / 1000) * 4)) * 60;
+void ClockHandler::countPulse(uint32_t t) {
+	newPulses++;
+	newPulseMicros = t;
+}
 
-			clockHighTime = millis();
-			clockSignal = 1;
+float ClockHandler::readClock() {
+
+	// check if new clock pulses have been taken from the input bus since the last read
+	pulses = newPulses;
+	uint32_t t = newPulseMicros;
+	newPulses = 0;
+
+	if (pulses > 0) {
+		testClockBPM = (float)60000000 / ((double)(t - pulseMicros) / pulses * pulsePPQN());
+		clockInterval = (t - pulseMicros) / pulses / 1000;
+		pulseMicros = t;
+		clockHighTime = millis();
+		clockSignal = 1;
 
 #if DEBUGCLOCK
-			Serial.println("High  BPM: " + String(clockBPM, 3) + "   tc: " + String(timeCounter) + "   ms: " + String(millis()));
+		Serial.println("High  BPM: " + String(clockBPM, 3) + "   ms: " + String(millis()));
 #endif
-		}
-		clockHigh = 1;
-		lastClockHigh = millis();
-	}
-	else {
-		clockHigh = 0;
-
 	}
 
 	//	check if clock signal is in BPM limits
@@ -92,8 +120,9 @@ float ClockHandler::readClock() {
 	}
 #endif
 
-	//	if clock signal has not fired or no good BPM reading in the last second clear BPM
-	if (millis() - clockHighTime > 1000 || millis() - lastGoodBPM > 1000) {
+	//	if clock signal has not fired or no good BPM reading in the last second (or longest pulse interval at low PPQN) clear BPM
+	uint32_t timeout = max((uint32_t)1000, (uint32_t)(60000 / (minBPM * pulsePPQN())) + 100);
+	if (millis() - clockHighTime > timeout || millis() - lastGoodBPM > timeout) {
 		clockSignal = 0;
 		clockBPM = 0;
 	}
@@ -1,33 +1,44 @@
 #pragma once
 #include "SetupFunctions.h"
+#include "QuantiseHandler.h"
+#include "Sequencer.h"
+#include "MidiHandler.h"
 
-extern int8_t cvStep, gateStep, editStep;
+extern int8_t editStep;
 extern editType editMode;
-extern float bpm, cvRandVal, getRandLimit(CvStep s, rndType getUpper);
-extern boolean gateRandVal, pause;
-extern seqType activeSeq;
+extern float bpm;
+extern int16_t getRandLimit(uint8_t seqNo, uint8_t step, rndType getUpper);
+extern uint8_t activeSeq;
 extern CvPatterns cv;
 extern GatePatterns gate;
-extern uint8_t cvSeqNo, gateSeqNo, cvLoopFirst, cvLoopLast, gateLoopFirst, gateLoopLast, submenuSize, submenuVal;
+extern uint8_t submenuSize, submenuVal;
 extern double getRand();
 extern boolean checkEditing();
 extern ClockHandler clock;
-extern String clockDiv;
+extern uint8_t clockMul, clockDiv;
 extern SetupMenu setupMenu;
+extern uint16_t userScales[];
+extern QuantiseHandler quantiser;
+extern Sequencer sequencer;
+extern GeneratorHandler generator;
+extern HistoryHandler history;
 
 class DisplayHandler {
 public:
 	DisplayHandler();
 	void updateDisplay();
 	void init();
-	int cvVertPos(float voltage);
+	int cvVertPos(uint16_t code);
 	void drawDottedVLine(int16_t x, int16_t y, int16_t h, uint16_t color);
 	void drawParam(String s, String v, int8_t x, uint8_t y, uint8_t w, boolean selected, uint8_t highlightX, uint8_t highlightW);
 	void drawParam(String s, String v, int8_t x, uint8_t y, uint8_t w, boolean selected);
 	void displayLanes();
 	void displayLFO();
 	void displaySetup();
-	String pitchFromVolt(float v);
+	String pitchFromVolt(uint16_t code);
+	String ratioName(uint8_t mul, uint8_t div);		// clock ratio for display eg 'x2', '/3' or '5:4'
+	String swingName(uint8_t patternSwing);			// pattern swing amount or 'Global' if following the global swing
+	String nudgeName(uint8_t *nudge, uint8_t step);	// step nudge in sixteenths of a step eg '+3/16'
 	Adafruit_SSD1306 display;
 private:
 	long clockSignal;
@@ -57,6 +68,7 @@ void DisplayHandler::updateDisplay() {
 		displayLanes();
 	}
 
+	midi.send();		// drawing a frame takes long enough to hold up MIDI out - send what has queued before the frame goes to the display
 	display.display(editMode == LFO || editMode == NOISE);
 #if DEBUGFRAME
 	int32_t m = micros();
@@ -105,7 +117,7 @@ void DisplayHandler::displaySetup() {
 
 	if (clock.hasSignal()) {
 		display.setCursor(105, 4);
-		display.print("C" + clockDiv);
+		display.print("C" + (clockMul == clockDiv ? "" : ratioName(clockMul, clockDiv)));
 	}
 
 	if (editMode == SUBMENU && !setupMenu.numberEdit) {
@@ -178,65 +190,95 @@ void DisplayHandler::displaySetup() {
 void DisplayHandler::displayLanes() {
 	boolean editing = checkEditing();		// set to true if currently editing to show detailed parameters
 
+	//	the top lane shows the active CV track (the main CV track when a gate track is active) and the bottom lane the active or main gate track
+	boolean cvActive = trackTypes[activeSeq] == SEQCV;
+	uint8_t cvTrack = cvActive ? activeSeq : SEQCV;
+	uint8_t gateTrack = cvActive ? SEQGATE : activeSeq;
+
 	//	Write the sequence number for CV and gate sequence
-	if (!editing || activeSeq == SEQCV) {
+	if (!editing || cvActive) {
 		display.setCursor(0, 0);
-		if (cv.seq[cvSeqNo].mode == PITCH) {
-			display.print(cv.seq[cvSeqNo].scale == 0 ? "Pi" : pitches[cv.seq[cvSeqNo].root] + "" + scalesShort[cv.seq[cvSeqNo].scale]);
+		if (cvTrack != SEQCV) {
+			display.print(trackNames[cvTrack]);
+		}
+		else if (cv.seq[sequencer.seqNo[cvTrack]].mode == PITCH) {
+			if (tunings[cv.seq[sequencer.seqNo[cvTrack]].tuning].degrees != 12) {
+				display.print(tuningsShort[cv.seq[sequencer.seqNo[cvTrack]].tuning]);
+			}
+			else {
+				display.print(cv.seq[sequencer.seqNo[cvTrack]].scale == 0 ? "Pi" : pitches[cv.seq[sequencer.seqNo[cvTrack]].root] + "" + scalesShort[cv.seq[sequencer.seqNo[cvTrack]].scale]);
+			}
 		}
 		else {
 			display.print("cv");
 		}
 	}
-	if (!editing || activeSeq == SEQGATE) {
+	if (!editing || !cvActive) {
 		display.setCursor(0, 39);
-		display.print(gate.seq[gateSeqNo].mode == TRIGGER ? "Tr" : "Gt");
+		display.print(gateTrack != SEQGATE ? trackNames[gateTrack] : gate.seq[sequencer.seqNo[gateTrack]].mode == TRIGGER ? "Tr" : "Gt");
 	}
 
 	display.setTextSize(2);
-	if (!editing || activeSeq == SEQCV) {
+	if (!editing || cvActive) {
 		display.setCursor(1, 11);
-		display.print(cvSeqNo + 1);
+		display.print(sequencer.seqNo[cvTrack] + 1);
 	}
-	if (!editing || activeSeq == SEQGATE) {
+	if (!editing || !cvActive) {
 		display.setCursor(1, 50);
-		display.print(gateSeqNo + 1);
+		display.print(sequencer.seqNo[gateTrack] + 1);
 	}
 	display.setTextSize(1);
 
 	// Draw dots at the top right if we have a clock high signal and number of dots indicating whether multiplying or dividing
 	if (clock.hasSignal()) {
 		display.drawPixel(127, 0, WHITE);
-		if (clockDiv == "x2" || clockDiv == "x4") display.drawPixel(127, 2, WHITE);
-		if (clockDiv == "x4") display.drawPixel(127, 4, WHITE);
-		if (clockDiv == "/2" || clockDiv == "/4") display.drawPixel(125, 0, WHITE);
-		if (clockDiv == "/4") display.drawPixel(123, 0, WHITE);
+		if (clockMul >= 2) display.drawPixel(127, 2, WHITE);
+		if (clockMul >= 4) display.drawPixel(127, 4, WHITE);
+		if (clockDiv >= 2) display.drawPixel(125, 0, WHITE);
+		if (clockDiv >= 4) display.drawPixel(123, 0, WHITE);
 	}
 
 	//	Draw arrow beneath/above sequence number if selected for editing
 	if (editStep == -1) {
-		display.drawLine(4, activeSeq == SEQCV ? 34 : 32, 6, activeSeq == SEQCV ? 32 : 34, WHITE);
-		display.drawLine(6, activeSeq == SEQCV ? 32 : 34, 8, activeSeq == SEQCV ? 34 : 32, WHITE);
+		display.drawLine(4, cvActive ? 34 : 32, 6, cvActive ? 32 : 34, WHITE);
+		display.drawLine(6, cvActive ? 32 : 34, 8, cvActive ? 34 : 32, WHITE);
+	}
+
+	//	Patterns longer than 8 steps are shown a page of 8 steps at a time - show the page being edited, otherwise the page currently playing
+	CvSequence &cs = cv.seq[sequencer.seqNo[cvTrack]];
+	GateSequence &gs = gate.seq[sequencer.seqNo[gateTrack]];
+	uint8_t cvPage = (editing && cvActive && editStep >= 0 ? editStep : (sequencer.step[cvTrack] > 0 ? sequencer.step[cvTrack] : 0)) / 8;
+	uint8_t gatePage = (editing && !cvActive && editStep >= 0 ? editStep : (sequencer.step[gateTrack] > 0 ? sequencer.step[gateTrack] : 0)) / 8;
+
+	//	Draw a dot for each page beneath the sequence number with the current page shown as a taller dot
+	for (uint8_t pg = 0; pg < (cs.steps + 7) / 8 && cs.steps > 8 && (!editing || cvActive); pg++) {
+		display.fillRect(1 + (pg * 2), pg == cvPage ? 28 : 29, 1, pg == cvPage ? 2 : 1, WHITE);
+	}
+	for (uint8_t pg = 0; pg < (gs.steps + 7) / 8 && gs.steps > 8 && (!editing || !cvActive); pg++) {
+		display.fillRect(1 + (pg * 2), 47, 1, pg == gatePage ? 2 : 1, WHITE);
 	}
 
 	// Draw the sequence steps for CV and gate sequence
 	for (int i = 0; i < 8; i++) {
 		int voltHPos = 17 + (i * 14);
-		int voltVPos = cvVertPos(cv.seq[cvSeqNo].Steps[i].volts);
+		uint8_t c = (cvPage * 8) + i;		// cv and gate step numbers shown in this column
+		uint8_t g = (gatePage * 8) + i;
+		int voltVPos = cvVertPos(cs.volts[c]);
 
 		// Draw CV pattern
-		if (!editing || activeSeq == SEQCV) {
+		if (!editing || cvActive) {
 
 			//	Show a dot where there is an unplayed step
-			if (i + 1 > cv.seq[cvSeqNo].steps) {
+			if (c + 1 > cs.steps) {
 				display.fillRect(voltHPos + 5, 30, 1, 1, WHITE);
 			}
 			else {
 				// Draw voltage line 
-				if (cv.seq[cvSeqNo].Steps[i].stutter > 0) {
-					float w = (float)12 / cv.seq[cvSeqNo].Steps[i].stutter;
+				uint8_t stutter = GetNibble(cs.stutter, c);
+				if (stutter > 0) {
+					float w = (float)12 / stutter;
 
-					for (int sd = 0; sd < cv.seq[cvSeqNo].Steps[i].stutter; sd++) {
+					for (int sd = 0; sd < stutter; sd++) {
 						// draw jagged stripes showing stutter pattern
 						display.fillRect(voltHPos + round(sd * w), voltVPos + (sd % 2 ? 0 : 1), round(w), 2, WHITE);
 					}
@@ -246,41 +288,46 @@ void DisplayHandler::displayLanes() {
 				}
 
 				//	show randomisation by using a vertical dotted line with height proportional to amount of randomisation
-				if (cv.seq[cvSeqNo].Steps[i].rand_amt > 0) {
-					float randLower = constrain(getRandLimit(cv.seq[cvSeqNo].Steps[i], LOWER), 0, 5);
-					float randUpper = constrain(getRandLimit(cv.seq[cvSeqNo].Steps[i], UPPER), 0, 5);
+				if (GetNibble(cs.randAmt, c) > 0) {
+					uint16_t randLower = constrain(getRandLimit(sequencer.seqNo[cvTrack], c, LOWER), 0, 4095);
+					uint16_t randUpper = constrain(getRandLimit(sequencer.seqNo[cvTrack], c, UPPER), 0, 4095);
 					drawDottedVLine(voltHPos, 2 + cvVertPos(randUpper), 1 + cvVertPos(randLower) - cvVertPos(randUpper), WHITE);
 				}
-				// draw amount of voltage selected after randomisation applied
-				if (cvStep == i) {
-					display.fillRect(voltHPos, round(26 - (cvRandVal * 5)), 13, 4, WHITE);
+				// draw amount of voltage selected after randomisation applied - and outline the pre-rolled value of the next random step
+				if (sequencer.step[cvTrack] == c) {
+					display.fillRect(voltHPos, cvVertPos(sequencer.value[cvTrack]) - 1, 13, 4, WHITE);
+				}
+				else if (sequencer.upcomingStep(cvTrack) == c && GetNibble(cs.randAmt, c) > 0 && sequencer.upcomingCV(cvTrack) >= 0) {
+					display.drawRect(voltHPos, cvVertPos(sequencer.upcomingCV(cvTrack)) - 1, 13, 4, WHITE);
 				}
 			}
 		
 		}
 
 		// Draw gate pattern 
-		if (!editing || activeSeq == SEQGATE) {
+		if (!editing || !cvActive) {
 
 			//	Show a dot where there is an unplayed step
-			if (i + 1 > gate.seq[gateSeqNo].steps) {
+			if (g + 1 > gs.steps) {
 				display.fillRect(voltHPos + 5, 63, 1, 1, WHITE);
 			}
 			else {
 
-				if (gate.seq[gateSeqNo].Steps[i].on || gate.seq[gateSeqNo].Steps[i].stutter > 0) {
-					if (gateStep == i && !gateRandVal) {
+				boolean on = GetBit(gs.on, g);
+				uint8_t stutter = GetNibble(gs.stutter, g);
+				if (on || stutter > 0) {
+					if (sequencer.step[gateTrack] == g && !sequencer.value[gateTrack]) {
 						display.drawRect(voltHPos + 4, 50, 6, 14, WHITE);		// draw gate as empty rectange for current step if set 'on' but randomised 'off'
 					}
 					else {
-						if (gate.seq[gateSeqNo].Steps[i].stutter > 0) {
+						if (stutter > 0) {
 
 							// draw base line
 							display.drawFastHLine(voltHPos + 3, 63, 8, WHITE);
-							float w = (float)8 / gate.seq[gateSeqNo].Steps[i].stutter;
-							for (int sd = 0; sd < round((float)gate.seq[gateSeqNo].Steps[i].stutter / 2); sd++) {
-								// draw vertical stripes showing stutter layout - if gate is off then stutter starts later														
-								display.fillRect(voltHPos + 3 + (gate.seq[gateSeqNo].Steps[i].on ? 0 : round(w)) + (sd * round(w * 2)), 50, round(w), 14, WHITE);
+							float w = (float)8 / stutter;
+							for (int sd = (on ? 0 : 1); sd < stutter; sd++) {
+								// draw vertical stripes showing each ratchet hit and its gate length - if gate is off then the first hit is skipped
+								display.fillRect(voltHPos + 3 + round(sd * w), 50, max((int)round(w * ratchetGates[gs.ratchetGate + 1] / 100), 1), 14, WHITE);
 							}
 						}
 						else {
@@ -294,8 +341,8 @@ void DisplayHandler::displayLanes() {
 			}
 
 			// draw current step - larger block if 'on' larger base if 'off'
-			if (gateStep == i && !pause) {
-				if (gateRandVal) {
+			if (sequencer.step[gateTrack] == g && !sequencer.pause) {
+				if (sequencer.value[gateTrack]) {
 					display.fillRect(voltHPos + 3, 45, 8, 29, WHITE);
 				}
 				else {
@@ -304,14 +351,14 @@ void DisplayHandler::displayLanes() {
 			}
 
 			// draw line showing random amount
-			uint8_t rndTop = round(gate.seq[gateSeqNo].Steps[i].rand_amt * (float)(24 / 10));
+			uint8_t rndTop = round(GetNibble(gs.randAmt, g) * (float)(24 / 10));
 			drawDottedVLine(voltHPos, 64 - rndTop, rndTop, WHITE);
 		}
 
 		//	Draw arrow beneath step selected for editing
-		if (editStep == i) {
-			display.drawLine(voltHPos + 4, activeSeq == SEQCV ? 34 : 32, voltHPos + 6, activeSeq == SEQCV ? 32 : 34, WHITE);
-			display.drawLine(voltHPos + 6, activeSeq == SEQCV ? 32 : 34, voltHPos + 8, activeSeq == SEQCV ? 34 : 32, WHITE);
+		if (editStep == (cvActive ? c : g)) {
+			display.drawLine(voltHPos + 4, cvActive ? 34 : 32, voltHPos + 6, cvActive ? 32 : 34, WHITE);
+			display.drawLine(voltHPos + 6, cvActive ? 32 : 34, voltHPos + 8, cvActive ? 34 : 32, WHITE);
 		}
 	}
 
@@ -320,39 +367,89 @@ void DisplayHandler::displayLanes() {
 	//	if currently or recently editing show values in bottom area of screen
 	// drawParam(string, value, x, y, w, selected, highlightX, highlightW)
 	if (editing) {
-		if (activeSeq == SEQGATE) {
+		if (!cvActive) {
 			if (editMode == STEPR || editMode == STEPV || editMode == STUTTER) {
-				drawParam("Gate", String(gate.seq[gateSeqNo].Steps[editStep].on ? "ON" : "OFF"), 0, 0, 36, editMode == STEPV);
-				drawParam("Random", String(gate.seq[gateSeqNo].Steps[editStep].rand_amt), 38, 0, 44, editMode == STEPR);
-				drawParam("Stutter", String(gate.seq[gateSeqNo].Steps[editStep].stutter), 81, 0, 47, editMode == STUTTER);
+				drawParam("Gate", String(GetBit(gs.on, editStep) ? "ON" : "OFF"), 0, 0, 36, editMode == STEPV);
+				drawParam("Random", String(GetNibble(gs.randAmt, editStep)), 38, 0, 44, editMode == STEPR);
+				drawParam("Stutter", String(GetNibble(gs.stutter, editStep)), 81, 0, 47, editMode == STUTTER);
+			}
+			if (editMode == STEPNUDGE) {
+				drawParam("Step", String(editStep + 1), 0, 0, 36, false);
+				drawParam("Nudge", nudgeName(gs.nudge, editStep), 38, 0, 44, true);
+				drawParam("Swing", swingName(gs.swing), 81, 0, 47, false);
+			}
+
+			//	Gate generator - hits (steps between hits for grid rhythms) out of pattern steps and rotation
+			if (editMode == GENFILL || editMode == GENROTATE) {
+				uint8_t p = sequencer.seqNo[gateTrack];
+				drawParam("Fill", initGateSeq[initGenFirst + generator.type[p]], 0, 0, 40, false);
+				drawParam(generator.type[p] == GENGRID ? "Every" : "Hits", String(generator.fill[p]) + "/" + String(gs.steps), 41, 0, 44, editMode == GENFILL);
+				drawParam("Rotate", String(generator.rotate[p]), 86, 0, 42, editMode == GENROTATE);
 			}
 
 			if (editMode == SEQMODE || editMode == STEPS || editMode == LOOPFIRST || editMode == LOOPLAST || editMode == SEQOPT) {
-				drawParam(gate.seq[gateSeqNo].mode ? "Trigger" : "Gate", String("Steps ") + String(gate.seq[gateSeqNo].steps), -2, 0, 49, editMode == STEPS, 36, 9);
-				drawParam("Loop", String(gateLoopFirst + 1) + String(" - ") + String(gateLoopLast + 1), 49, 0, 38, editMode == LOOPFIRST || editMode == LOOPLAST, editMode == LOOPFIRST ? 51 : 75, 9);
+				drawParam(gs.mode ? "Trigger" : "Gate", String("Steps ") + String(gs.steps), -2, 0, 49, editMode == STEPS, 36, gs.steps > 9 ? 15 : 9);
+				drawParam("Loop", String(sequencer.loopFirst[gateTrack] + 1) + String(" - ") + String(sequencer.loopLast[gateTrack] + 1), 49, 0, 38, editMode == LOOPFIRST || editMode == LOOPLAST, editMode == LOOPFIRST ? 51 : 75, 9);
 				drawParam("Rand", initGateSeq[submenuVal], 88, 0, 40, editMode == SEQOPT, 90, 36);
 				if (editMode == SEQMODE) {
 					display.fillRect(0, 1, 45, 11, INVERSE);
 				}
-				//drawParam("Steps", String(gate.seq[gateSeqNo].steps), 0, 0, 36, editMode == STEPS);
-				//drawParam("Loop", String(gateLoopFirst + 1) + String(" - ") + String(gateLoopLast + 1), 38, 0, 38, editMode == LOOPFIRST || editMode == LOOPLAST, editMode == LOOPFIRST ? 40 : 64, 9);
+				//drawParam("Steps", String(gate.seq[sequencer.seqNo[gateTrack]].steps), 0, 0, 36, editMode == STEPS);
+				//drawParam("Loop", String(sequencer.loopFirst[gateTrack] + 1) + String(" - ") + String(sequencer.loopLast[gateTrack] + 1), 38, 0, 38, editMode == LOOPFIRST || editMode == LOOPLAST, editMode == LOOPFIRST ? 40 : 64, 9);
 				//drawParam("Rand", initGateSeq[submenuVal], 80, 0, 42, editMode == SEQOPT, 82, 38);
 
 
 			}
 		}
 
-		if (activeSeq == SEQCV) {
+		//	Track clock ratio and playback order and pattern swing
+		if (editMode == SEQRATIO || editMode == SEQDIR || editMode == SEQSWING) {
+			uint8_t y = cvActive ? 39 : 0;
+			drawParam("Clock", ratioName(sequencer.ratioMul[activeSeq], sequencer.ratioDiv[activeSeq]), 0, y, 40, editMode == SEQRATIO);
+			drawParam("Dir", directions[sequencer.direction[activeSeq]], 41, y, 40, editMode == SEQDIR);
+			drawParam("Swing", swingName(cvActive ? cs.swing : gs.swing), 82, y, 46, editMode == SEQSWING);
+		}
+
+		//	Random history lock and chance of rerolling each locked step
+		if (editMode == SEQLOCK || editMode == SEQMUTATE) {
+			uint8_t y = cvActive ? 39 : 0;
+			uint8_t p = sequencer.seqNo[activeSeq];
+			drawParam("Lock", OffOnOpts[history.isLocked(trackTypes[activeSeq], p)], 0, y, 40, editMode == SEQLOCK);
+			drawParam("Mutate", String(history.mutate[trackTypes[activeSeq]][p] * 10) + "%", 41, y, 50, editMode == SEQMUTATE);
+		}
+
+		//	Ratchet shape and gate length or CV ramp
+		if (editMode == SEQRATCHET || editMode == SEQRATCHETLEN) {
+			uint8_t y = cvActive ? 39 : 0;
+			drawParam("Ratchet", ratchetShapes[(cvActive ? cs.ratchetCurve : gs.ratchetCurve) + RATCHETCURVE], 0, y, 50, editMode == SEQRATCHET);
+			drawParam(cvActive ? "Ramp" : "Length", cvActive ? OffOnOpts[cs.ratchetRamp] : ratchetGateNames[gs.ratchetGate + 1], 51, y, 50, editMode == SEQRATCHETLEN);
+		}
+
+		//	Markov weights of each jump
+		if (editMode == SEQMARKOV) {
+			uint8_t y = cvActive ? 39 : 0;
+			uint8_t weights = cvActive ? cs.markov : gs.markov;
+			for (uint8_t j = 0; j < markovJumpSize; j++) {
+				drawParam(markovJumps[j], String((weights >> (j * 2)) & 3), j * 32, y, 31, submenuVal == j);
+			}
+		}
+
+		if (cvActive) {
 			if (editMode == STEPR || editMode == STEPV || editMode == STUTTER) {
-				String v = cv.seq[cvSeqNo].mode == PITCH ? pitchFromVolt(cv.seq[cvSeqNo].Steps[editStep].volts) : String(cv.seq[cvSeqNo].Steps[editStep].volts);
-				drawParam(cv.seq[cvSeqNo].mode == PITCH ? "Pitch" : "Volts", v, 0, 39, 36, editMode == STEPV);
-				drawParam("Random", String(cv.seq[cvSeqNo].Steps[editStep].rand_amt), 38, 39, 44, editMode == STEPR);
-				drawParam("Stutter", String(cv.seq[cvSeqNo].Steps[editStep].stutter), 81, 39, 47, editMode == STUTTER);
+				String v = cs.mode == PITCH ? pitchFromVolt(cs.volts[editStep]) : String((float)cs.volts[editStep] / DACVOLT);
+				drawParam(cv.seq[sequencer.seqNo[cvTrack]].mode == PITCH ? "Pitch" : "Volts", v, 0, 39, 36, editMode == STEPV);
+				drawParam("Random", String(GetNibble(cs.randAmt, editStep)), 38, 39, 44, editMode == STEPR);
+				drawParam("Stutter", String(GetNibble(cs.stutter, editStep)), 81, 39, 47, editMode == STUTTER);
+			}
+			if (editMode == STEPNUDGE) {
+				drawParam("Step", String(editStep + 1), 0, 39, 36, false);
+				drawParam("Nudge", nudgeName(cs.nudge, editStep), 38, 39, 44, true);
+				drawParam("Swing", swingName(cs.swing), 81, 39, 47, false);
 			}
 
 			if (editMode == SEQMODE || editMode == STEPS || editMode == LOOPFIRST || editMode == LOOPLAST || editMode == SEQOPT) {
-				drawParam(cv.seq[cvSeqNo].mode == CV ? "CV" : "Pitch", String("Steps ") + String(cv.seq[cvSeqNo].steps), -2, 39, 49, editMode == STEPS, 36, 9);
-				drawParam("Loop", String(cvLoopFirst + 1) + String(" - ") + String(cvLoopLast + 1), 49, 39, 38, editMode == LOOPFIRST || editMode == LOOPLAST, editMode == LOOPFIRST ? 51 : 75, 9);
+				drawParam(cs.mode == CV ? "CV" : "Pitch", String("Steps ") + String(cs.steps), -2, 39, 49, editMode == STEPS, 36, cs.steps > 9 ? 15 : 9);
+				drawParam("Loop", String(sequencer.loopFirst[cvTrack] + 1) + String(" - ") + String(sequencer.loopLast[cvTrack] + 1), 49, 39, 38, editMode == LOOPFIRST || editMode == LOOPLAST, editMode == LOOPFIRST ? 51 : 75, 9);
 				drawParam("Rand", initCVSeq[submenuVal], 88, 39, 40, editMode == SEQOPT, 90, 36);
 				if (editMode == SEQMODE) {
 					display.fillRect(0, 40, 45, 11, INVERSE);
@@ -360,9 +457,41 @@ void DisplayHandler::displayLanes() {
 			}
 
 			if (editMode == SEQROOT || editMode == SEQSCALE) {
-				drawParam("Root", pitches[cv.seq[cvSeqNo].root], 0, 39, 35, editMode == SEQROOT);
-				drawParam("Scale", scales[cv.seq[cvSeqNo].scale], 36, 39, 90, editMode == SEQSCALE);
+				drawParam("Root", pitches[cv.seq[sequencer.seqNo[cvTrack]].root], 0, 39, 35, editMode == SEQROOT);
+				drawParam("Scale", scales[cv.seq[sequencer.seqNo[cvTrack]].scale], 36, 39, 90, editMode == SEQSCALE);
+
+			}
 
+			if (editMode == SEQTUNING) {
+				drawParam("Root", pitches[cv.seq[sequencer.seqNo[cvTrack]].root], 0, 39, 35, false);
+				drawParam("Tuning", tuningNames[cv.seq[sequencer.seqNo[cvTrack]].tuning], 36, 39, 90, true);
+			}
+
+			//	User scale editing - show a box for each note (filled if in scale) with the selected note underlined
+			if (editMode == SCALEEDIT) {
+				uint16_t mask = userScales[cv.seq[sequencer.seqNo[cvTrack]].scale - userScaleFirst];
+				display.setCursor(4, 41);
+				display.print(scales[cv.seq[sequencer.seqNo[cvTrack]].scale]);
+				if (submenuVal < 12) {
+					display.setCursor(80, 41);
+					display.print(pitches[(cv.seq[sequencer.seqNo[cvTrack]].root + submenuVal) % 12]);
+				}
+				for (uint8_t n = 0; n < 12; n++) {
+					if ((mask >> n) & 1) {
+						display.fillRect(4 + (n * 9), 51, 7, 9, WHITE);
+					}
+					else {
+						display.drawRect(4 + (n * 9), 51, 7, 9, WHITE);
+					}
+				}
+				display.setCursor(113, 52);
+				display.print("OK");
+				if (submenuVal < 12) {
+					display.drawFastHLine(4 + (submenuVal * 9), 62, 7, WHITE);
+				}
+				else {
+					display.fillRect(111, 51, 15, 10, INVERSE);
+				}
 			}
 
 		}
@@ -371,8 +500,8 @@ void DisplayHandler::displayLanes() {
 
 
 //	returns the vertical position of a voltage line on the cv channel display
-int DisplayHandler::cvVertPos(float voltage) {
-	return 27 - round(voltage * 5);
+int DisplayHandler::cvVertPos(uint16_t code) {
+	return 27 - round((float)code * 5 / DACVOLT);
 }
 
 void DisplayHandler::drawDottedVLine(int16_t x, int16_t y, int16_t h, uint16_t color) {
@@ -400,9 +529,28 @@ void DisplayHandler::drawParam(String s, String v, int8_t x, uint8_t y, uint8_t
 	}
 }
 
-//	returns the nearest note name from a given 1v/oct voltage
-String DisplayHandler::pitchFromVolt(float v) {
-	return pitches[round(v * 12) % 12] + (String)int(v);
+//	returns the nearest note name from a given 1v/oct voltage in the current pattern's tuning
+String DisplayHandler::pitchFromVolt(uint16_t code) {
+	return quantiser.noteName(sequencer.seqNo[activeSeq], code);
+}
+
+String DisplayHandler::ratioName(uint8_t mul, uint8_t div) {
+	if (div == 1) {
+		return "x" + String(mul);
+	}
+	if (mul == 1) {
+		return "/" + String(div);
+	}
+	return String(mul) + ":" + String(div);
+}
+
+String DisplayHandler::swingName(uint8_t patternSwing) {
+	return patternSwing > 0 ? swingNames[patternSwing - 1] : "Global";
+}
+
+String DisplayHandler::nudgeName(uint8_t *nudge, uint8_t step) {
+	int8_t n = SignedNibble(GetNibble(nudge, step & 7));
+	return n == 0 ? "0" : (n > 0 ? "+" : "") + String(n) + "/" + String(NUDGEDIV);
 }
 
 void DisplayHandler::init() {
@@ -0,0 +1,99 @@
+#pragma once
+// Gate pattern generator - fills a gate pattern with Euclidean, density or grid rhythms built as a 64 bit step mask
+// Changes to a playing pattern are held until the pattern wraps round so the rhythm changes on the pattern boundary
+// The rhythm is built in loop() when the edit is made - the sequencer interrupt only merges the waiting bits into the pattern
+#include "Settings.h"
+
+extern GatePatterns gate;
+extern double getRand();
+
+class GeneratorHandler {
+public:
+	uint8_t type[8];									// genType of each gate pattern
+	uint8_t fill[8] = { 4, 4, 4, 4, 4, 4, 4, 4 };		// Euclid/Density: number of hits; Grid: steps between hits
+	uint8_t rotate[8];									// steps the rhythm is rotated to the right
+
+	void request(uint8_t p);			// parameters of pattern p have changed - build its rhythm now and merge it when the pattern next wraps round - call from loop()
+	boolean pending(uint8_t p) { return (pendingMask >> p) & 1; }
+	void apply(uint8_t p);				// merge the rhythm waiting for pattern p into its steps now - safe from the sequencer interrupt
+
+private:
+	uint64_t euclid(uint8_t k, uint8_t n);
+	uint64_t density(uint8_t k, uint8_t n);
+	uint64_t grid(uint8_t k, uint8_t n);
+
+	volatile uint8_t pendingMask;		// bit set for each pattern waiting to be regenerated
+	uint64_t pendingBits[8];			// rotated rhythm waiting for each pattern
+	uint64_t pendingSteps[8];			// bit set for each step of the pattern length the rhythm was built for
+};
+
+void GeneratorHandler::request(uint8_t p) {
+	uint8_t n = gate.seq[p].steps;
+	uint8_t k = min(fill[p], n);
+	uint64_t bits = type[p] == GENEUCLID ? euclid(k, n) : (type[p] == GENDENSITY ? density(k, n) : grid(k, n));
+
+	// rotate within the pattern length - steps beyond the pattern length are left untouched when merged
+	uint64_t mask = n == 64 ? ~0ULL : (1ULL << n) - 1;
+	uint8_t r = rotate[p] % n;
+	bits &= mask;
+	if (r) {
+		bits = ((bits << r) | (bits >> (n - r))) & mask;
+	}
+
+	noInterrupts();
+	pendingBits[p] = bits;
+	pendingSteps[p] = mask;
+	pendingMask |= 1 << p;
+	interrupts();
+}
+
+void GeneratorHandler::apply(uint8_t p) {
+	pendingMask &= ~(1 << p);
+
+	uint64_t bits = pendingBits[p];
+	uint64_t mask = pendingSteps[p];
+	for (uint8_t b = 0; b < MAXSTEPS / 8; b++) {
+		uint8_t m = mask >> (b * 8);
+		gate.seq[p].on[b] = (gate.seq[p].on[b] & ~m) | ((bits >> (b * 8)) & m);
+	}
+}
+
+uint64_t GeneratorHandler::euclid(uint8_t k, uint8_t n) {
+	// Bresenham spread of k hits over n steps - gives the same rhythms as Bjorklund's algorithm up to rotation
+	uint64_t bits = 0;
+	uint8_t acc = 0;
+	for (uint8_t i = 0; i < n; i++) {
+		if (acc < k) {
+			bits |= 1ULL << i;
+		}
+		acc += k;
+		if (acc >= n) {
+			acc -= n;
+		}
+	}
+	return k ? bits : 0;
+}
+
+uint64_t GeneratorHandler::density(uint8_t k, uint8_t n) {
+	// exactly k hits at random positions - each step is a hit with probability (hits left / steps left)
+	uint64_t bits = 0;
+	for (uint8_t i = 0; i < n; i++) {
+		if (getRand() * (n - i) < k) {
+			bits |= 1ULL << i;
+			k--;
+		}
+	}
+	return bits;
+}
+
+uint64_t GeneratorHandler::grid(uint8_t k, uint8_t n) {
+	// a hit every k steps - built by doubling the repeating unit until it covers the pattern
+	if (k == 0) {
+		return 0;
+	}
+	uint64_t bits = 1;
+	for (uint8_t len = k; len < n; len *= 2) {
+		bits |= bits << len;
+	}
+	return bits;
+}
@@ -0,0 +1,72 @@
+#pragma once
+// Turing machine style random history - the random outcome of every step of each pattern is recorded as it plays
+// Locking a pattern replays its recorded outcomes on each pass, with a mutate chance of rerolling each step as it plays
+// Outcomes are step values and gate flips, the mute of each ratchet hit, and for random walk and Markov playback the step each pass starts on and the die choosing each move
+#include "Settings.h"
+
+class HistoryHandler {
+public:
+	uint8_t mutate[2][8];		// chance out of 10 that a locked step is rerolled - indexed by seqType and pattern
+
+	boolean isLocked(uint8_t type, uint8_t p) { return (locked[type] >> p) & 1; }
+	void toggleLock(uint8_t type, uint8_t p) { locked[type] ^= 1 << p; }
+	uint16_t cvDie(uint8_t p, uint8_t s, uint16_t die, boolean record);	// returns the die setting a CV step's random value - replayed if locked, otherwise recorded if record set
+	boolean gateFlip(uint8_t p, uint8_t s, boolean flip, uint16_t die);	// returns whether a gate step is flipped by randomisation - recorded or replayed
+	boolean ratchetMute(uint8_t p, uint8_t s, uint8_t k, boolean mute, uint16_t die);	// returns whether ratchet hit k of a gate step is muted - recorded or replayed
+	uint16_t orderDie(uint8_t type, uint8_t p, uint8_t i, uint16_t die);	// returns the die choosing move i of a pass of a random walk or Markov pattern - recorded or replayed
+	uint8_t passStart(uint8_t type, uint8_t p, uint8_t s);	// returns the step a pass of a random walk or Markov pattern starts on - s is recorded unless locked
+
+private:
+	boolean reroll(uint8_t type, uint8_t p, uint8_t chance);
+
+	volatile uint8_t locked[2];				// bit set for each locked pattern
+	uint8_t cvHistory[8][MAXSTEPS];			// top byte of the die that set each CV step - values follow later edits to the step's voltage or random range
+	uint8_t gateHistory[8][MAXSTEPS / 8];	// packed bits - set if randomisation flipped the gate step
+	uint16_t muteHistory[8][MAXSTEPS];		// bit set for each ratchet hit of the gate step that was muted
+	uint16_t orderHistory[2][8][MAXSTEPS];	// die that chose each move of the last pass - indexed by the move's place in the pass
+	uint8_t startHistory[2][8];				// step the last pass started on
+};
+
+boolean HistoryHandler::reroll(uint8_t type, uint8_t p, uint8_t chance) {
+	// chance is a random value from 0 to 9 taken from bits of the die not used for the step's outcome
+	return !isLocked(type, p) || chance < mutate[type][p];
+}
+
+uint16_t HistoryHandler::cvDie(uint8_t p, uint8_t s, uint16_t die, boolean record) {
+	if (!reroll(SEQCV, p, ((die & 0xFF) * 10) >> 8)) {
+		return (cvHistory[p][s] << 8) | 0x80;
+	}
+	if (record) {
+		cvHistory[p][s] = die >> 8;
+	}
+	return (die & 0xFF00) | 0x80;
+}
+
+boolean HistoryHandler::gateFlip(uint8_t p, uint8_t s, boolean flip, uint16_t die) {
+	if (reroll(SEQGATE, p, (((die >> 8) & 0x7F) * 10) >> 7)) {
+		SetBit(gateHistory[p], s, flip);
+	}
+	return GetBit(gateHistory[p], s);
+}
+
+boolean HistoryHandler::ratchetMute(uint8_t p, uint8_t s, uint8_t k, boolean mute, uint16_t die) {
+	if (reroll(SEQGATE, p, (((die >> 8) & 0x7F) * 10) >> 7)) {
+		muteHistory[p][s] = (muteHistory[p][s] & ~(1 << k)) | (mute << k);
+	}
+	return (muteHistory[p][s] >> k) & 1;
+}
+
+uint16_t HistoryHandler::orderDie(uint8_t type, uint8_t p, uint8_t i, uint16_t die) {
+	// Markov playback uses every bit of the die so the mutate chance is taken from a scrambled copy
+	if (reroll(type, p, (((uint16_t)(die * 40503) >> 8) * 10) >> 8)) {
+		orderHistory[type][p][i] = die;
+	}
+	return orderHistory[type][p][i];
+}
+
+uint8_t HistoryHandler::passStart(uint8_t type, uint8_t p, uint8_t s) {
+	if (!isLocked(type, p)) {
+		startHistory[type][p] = s;
+	}
+	return startHistory[type][p];
+}
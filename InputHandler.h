@@ -0,0 +1,74 @@
+#pragma once
+// Input event bus - buttons, the action CV input, the encoder and clock pulses are queued as typed events stamped with the time they were captured
+// Each interrupt that captures inputs writes its own lane so every lane has one writer and one reader and needs no locks; loop() reads all the lanes
+// through get(), which takes the earliest waiting event so the inputs are handled in the order they happened
+#include "Settings.h"
+
+enum inputEventType {
+	INPUTPRESS,			// source: index into btns[]
+	INPUTRELEASE,		// source: index into btns[]
+	INPUTLONG,			// source: index into btns[] - time is when the press became a long press
+	INPUTENCODER,		// value: detents turned, positive clockwise
+	INPUTCLOCK			// source: clockSource - a pulse accepted by the clock tracker
+};
+
+// one lane for each interrupt that writes events
+enum inputLane {
+	LANEPANEL,			// button timer interrupt - buttons, action CV and encoder
+	LANECLOCKPIN,		// clock pin interrupt
+	LANESEQTIMER,		// sequencer timer interrupt - MIDI clock
+	LANES
+};
+
+struct InputEvent {
+	uint8_t type;		// inputEventType
+	uint8_t source;
+	int8_t value;
+	uint32_t time;		// time in microseconds the input was captured
+};
+
+class InputHandler {
+public:
+	boolean push(inputLane lane, inputEventType type, uint8_t source, int8_t value, uint32_t time);	// queue an event - only ever called from the interrupt owning the lane; false if the lane is full
+	boolean get(InputEvent &e);			// take the earliest waiting event from any lane - false if none; call from loop() only
+	uint8_t space(inputLane lane) { return (lanes[lane].read + laneSize - lanes[lane].write - 1) % laneSize; }	// events that can be pushed before the lane is full
+
+private:
+	static const uint8_t laneSize = 32;
+	struct Lane {
+		InputEvent events[laneSize];
+		volatile uint8_t write;
+		volatile uint8_t read;
+	};
+	Lane lanes[LANES];
+};
+
+boolean InputHandler::push(inputLane lane, inputEventType type, uint8_t source, int8_t value, uint32_t time) {
+	//	the event is written before the write index moves on so the reader never sees it half written
+	Lane &l = lanes[lane];
+	uint8_t next = (l.write + 1) % laneSize;
+	if (next == l.read) {
+		return 0;
+	}
+	l.events[l.write] = { (uint8_t)type, source, value, time };
+	l.write = next;
+	return 1;
+}
+
+boolean InputHandler::get(InputEvent &e) {
+	//	events are read before the read index moves on so the writer never overwrites an event being read
+	int8_t first = -1;
+	for (uint8_t i = 0; i < LANES; i++) {
+		Lane &l = lanes[i];
+		if (l.read != l.write && (first < 0 || (int32_t)(l.events[l.read].time - lanes[first].events[lanes[first].read].time) < 0)) {
+			first = i;
+		}
+	}
+	if (first < 0) {
+		return 0;
+	}
+	Lane &l = lanes[first];
+	e = l.events[l.read];
+	l.read = (l.read + 1) % laneSize;
+	return 1;
+}
@@ -0,0 +1,172 @@
+#pragma once
+// USB-MIDI - clock, start, stop and continue drive the sequencer; CV and gate outputs are sent as notes and controllers on each track's channel
+// Incoming messages are read without waiting by the sequencer timer interrupt and queued with the time they arrived; outgoing messages are queued
+// by the interrupt with the time their output event fell due and sent from loop() as USB-MIDI cannot be written from an interrupt - send() is called at the top
+// of loop() and between drawing a display frame and sending it to the display so a message waits at most the longest of those stretches (see midi_test)
+#include "Settings.h"
+#include "ClockHandler.h"
+#include "Sequencer.h"
+
+extern CvPatterns cv;
+extern ClockHandler clock;
+extern Sequencer sequencer;
+
+class MidiHandler {
+public:
+	void begin();							// register the real time message handler - call from setup()
+	void receive();							// read waiting messages then act on queued clock and transport messages - called from the sequencer timer interrupt
+	void output(const SeqEvent &e);			// queue the MIDI messages for an output event as it falls due - called from the sequencer timer interrupt
+	void send();							// send queued messages - call at the top of loop() and between display chunks
+	static void onRealTime(uint8_t type);	// usbMIDI handler for clock, start, continue and stop
+
+private:
+	struct MidiIn {
+		uint8_t type;			// real time status byte
+		uint32_t time;			// time in microseconds the message was read
+	};
+	struct MidiOut {
+		uint8_t status;			// message type and channel
+		uint8_t data1;			// note or controller number
+		uint8_t data2;			// velocity or controller value
+		uint32_t time;			// time in microseconds the output event fell due
+	};
+	void queue(uint8_t status, uint8_t data1, uint8_t data2, uint32_t time);
+
+	static const uint8_t inSize = 16;
+	static const uint8_t outSize = 32;
+	static const uint8_t maxReads = 16;			// messages read per interrupt
+	MidiIn in[inSize];
+	volatile uint8_t inWrite;
+	volatile uint8_t inRead;
+	MidiOut out[outSize];
+	volatile uint8_t outWrite;
+	volatile uint8_t outRead;
+	int8_t heldNote[TRACKS] = { -1, -1, -1, -1 };		// note left on by each track - -1 if none
+	int16_t lastCC[TRACKS] = { -1, -1, -1, -1 };		// controller value last sent by each CV mode track
+};
+
+extern MidiHandler midi;
+
+void MidiHandler::begin() {
+#if USBMIDI
+	usbMIDI.setHandleRealTimeSystem(onRealTime);
+#endif
+}
+
+void MidiHandler::onRealTime(uint8_t type) {
+	//	a full queue drops the message - the clock tracker rides over a missing pulse
+	uint8_t next = (midi.inWrite + 1) % inSize;
+	if (next != midi.inRead && (type == 0xF8 || type == 0xFA || type == 0xFB || type == 0xFC)) {
+		midi.in[midi.inWrite].type = type;
+		midi.in[midi.inWrite].time = micros();
+		midi.inWrite = next;
+	}
+}
+
+void MidiHandler::receive() {
+#if USBMIDI
+	//	safe to read from this interrupt: usbMIDI.read() is only called here so the receive packet it keeps between calls has a single user,
+	//	it takes and frees USB buffers with interrupts disabled as the USB interrupt filling them does, and it never waits for data
+	//	sending from loop() uses the separate transmit packet, and the only handler registered just queues the message
+	//	reading here rather than in loop() stamps each clock within 100us of its arrival however long a display update takes
+	for (uint8_t i = 0; i < maxReads && usbMIDI.read(); i++) {
+	}
+#endif
+
+	while (inRead != inWrite) {
+		MidiIn &m = in[inRead];
+		switch (m.type) {
+		case 0xF8:			// clock
+			if (clock.onPulse(m.time, SOURCEMIDI)) {
+				sequencer.onClock(m.time, MIDIPPQN);
+			}
+			break;
+		case 0xFA:			// start
+			sequencer.start();
+			break;
+		case 0xFB:			// continue
+			if (sequencer.pause) {
+				sequencer.togglePause();
+			}
+			break;
+		case 0xFC:			// stop
+			if (!sequencer.pause) {
+				sequencer.togglePause();
+			}
+			break;
+		}
+		inRead = (inRead + 1) % inSize;
+	}
+}
+
+void MidiHandler::output(const SeqEvent &e) {
+	//	pitch mode CV tracks retrigger a note on each output, CV mode tracks send a controller and gate tracks hold their note while the gate is high
+#if USBMIDI
+	uint8_t t = e.track;
+	if (e.type == EVENTCV && cv.seq[sequencer.seqNo[t]].mode == CV) {
+		if (heldNote[t] >= 0) {
+			queue(0x80 | t, heldNote[t], 0, e.time);
+			heldNote[t] = -1;
+		}
+		int16_t cc = e.value >> 5;
+		if (cc != lastCC[t]) {
+			queue(0xB0 | t, MIDICVCC, cc, e.time);
+			lastCC[t] = cc;
+		}
+		return;
+	}
+	if (heldNote[t] >= 0 && (e.type == EVENTCV || e.value == 0)) {
+		queue(0x80 | t, heldNote[t], 0, e.time);
+		heldNote[t] = -1;
+	}
+	if (heldNote[t] < 0 && (e.type == EVENTCV || e.value > 0)) {
+		heldNote[t] = e.type == EVENTCV ? MIDICVNOTE + (e.value * 12 + DACVOLT / 2) / DACVOLT : MIDIGATENOTE;
+		queue(0x90 | t, heldNote[t], 100, e.time);
+	}
+#endif
+}
+
+void MidiHandler::queue(uint8_t status, uint8_t data1, uint8_t data2, uint32_t time) {
+	uint8_t next = (outWrite + 1) % outSize;
+	if (next != outRead) {
+		out[outWrite] = { status, data1, data2, time };
+		outWrite = next;
+	}
+}
+
+void MidiHandler::send() {
+#if USBMIDI
+	//	notes left on by CV tracks are ended when the sequencer pauses - gate tracks are ended by the pause's gate off events
+	noInterrupts();
+	for (uint8_t t = 0; t < TRACKS && sequencer.pause; t++) {
+		if (trackTypes[t] == SEQCV && heldNote[t] >= 0) {
+			queue(0x80 | t, heldNote[t], 0, micros());
+			heldNote[t] = -1;
+		}
+	}
+	interrupts();
+
+	boolean sent = 0;
+	while (outRead != outWrite) {
+		MidiOut &m = out[outRead];
+		uint8_t channel = (m.status & 0xF) + 1;
+		if ((m.status & 0xF0) == 0x90) {
+			usbMIDI.sendNoteOn(m.data1, m.data2, channel);
+		}
+		else if ((m.status & 0xF0) == 0x80) {
+			usbMIDI.sendNoteOff(m.data1, m.data2, channel);
+		}
+		else {
+			usbMIDI.sendControlChange(m.data1, m.data2, channel);
+		}
+#if DEBUGMIDI
+		Serial.println("MIDI " + String(m.status, HEX) + " " + String(m.data1) + " " + String(m.data2) + " late: " + String(micros() - m.time));
+#endif
+		outRead = (outRead + 1) % outSize;
+		sent = 1;
+	}
+	if (sent) {
+		usbMIDI.send_now();
+	}
+#endif
+}
@@ -2,8 +2,21 @@
 #include <Encoder.h>
 #include "Adafruit_SSD1306.h"
 #include "ClockHandler.h"
+#include "CalibrationHandler.h"
+#include "QuantiseHandler.h"
+#include "GeneratorHandler.h"
+#include "HistoryHandler.h"
+#include "SongHandler.h"
+#include "PresetHandler.h"
+#include "StorageHandler.h"
+#include "Sequencer.h"
 #include "DisplayHandler.h"
 #include "SetupFunctions.h"
+#include "SerialHandler.h"
+#include "MidiHandler.h"
+#include "UndoHandler.h"
+#include "InputHandler.h"
+#include "ButtonHandler.h"
 #include "Settings.h"
 
 
@@ -12,45 +25,23 @@ uint16_t tempoPot = 512, oldTempoPot = 0;		// Reading from tempo potentiometer f
 float bpm = 120;				// beats per minute of sequence (assume sequence runs in eighth notes for now)
 uint16_t minBPM = 35;			// minimum BPM allowed for internal/external clock
 uint16_t maxBPM = 300;			// maximum BPM allowed for internal/external clock
-elapsedMillis timeCounter = 0;  // millisecond counter to check if next sequence step is due
 elapsedMillis debugCounter = 0;	// used to show debug data only every couple of ms
-uint32_t guessNextStep;			// guesstimate of when next step will fall - to avoid display firing at wrong time
 uint32_t lastEditing = 0;		// ms counter to show detailed edit parameters while editing or just after
-boolean saveRequired;			// set to true after editing a parameter needing a save (saves batched to avoid too many writes)
+uint32_t dirtyRecords;			// bit set for each storage record edited since it was last saved (saves batched to avoid too many writes)
 boolean autoSave = 1;			// set to true if autosave enabled
-float cvRandVal = 0;			// Voltage of current step with randomisation applied
-boolean gateRandVal;			// 1 or 0 according to whether gate is high or low after randomisation
-uint32_t lastGate;				// Time gate was last set to high for use with trigger mode
-uint8_t cvStutterStep;			// if a step is in stutter mode store the count of the current stutters 
-uint8_t gateStutterStep;		// if a step is in stutter mode store the count of the current stutters 
-uint8_t cvSeqNo = 0;			// store the sequence number for CV patterns
-uint8_t gateSeqNo = 0;			// store the sequence number for Gate patterns
-uint8_t cvLoopFirst = 0;		// first sequence in loop
-uint8_t cvLoopLast = 0;			// last sequence in loop
-uint8_t gateLoopFirst = 0;		// first sequence in loop
-uint8_t gateLoopLast = 0;		// last sequence in loop
-int8_t cvStep = -1;				// increments each step of cv sequence
-int8_t gateStep = -1;			// increments each step of gate sequence
-int8_t editStep = 0;			// store which step is currently selected for editing (-1 = choose seq, 0-7 are the sequence steps)
+int8_t editStep = 0;			// store which step is currently selected for editing (-1 = choose seq, 0 to MAXSTEPS - 1 are the sequence steps)
 editType editMode = STEPV;		// enum editType - eg editing voltage, random amts etc
-seqType activeSeq = SEQCV;		// whether the CV or Gate rows is active for editing
+uint8_t activeSeq = SEQCV;		// track active for editing - SEQCV and SEQGATE are the main CV and gate tracks, further tracks follow
 float clockBPM = 0;				// BPM read from external clock
-long oldEncPos = 0;
-boolean pause;					// if true pause sequencers
-boolean actionStutter;			// Stutter triggered by action button
-uint8_t stutterStep;			// When stutter is triggered by action button store stutter step number based on current clock speed 
-uint8_t actionStutterNo = 8;	// Number of stutter steps when triggered by action button
 float lfoX = 1, lfoY = 0;		// LFO parameters for quick Minsky approximation
 float lfoSpeed;					// lfoSpeed calculated from tempo pot
 float oldLfoSpeed;				// lfoSpeed calculated from tempo pot
 uint8_t lfoJitter;				// because the analog pot is more sensitive at the bottom of its range adjust the threshold before detecting a pot turn
-uint8_t oldRoot = -1;			// previous root note to check if we need to rebuild quantise table
-uint8_t oldScale;				// previous scale
 elapsedMillis lfoCounter = 0;	// millisecond counter to check if next lfo calculation is due
 uint8_t submenuSize;			// number of items in array used to pick from submenu items
 uint8_t submenuVal;				// currently selected submenu item
-String clockDiv = "";			// shows whether a clock divider is in place in the setup menu (clocked input with multiplier/divider provided by tempo pot)
-int8_t cvOffset;				// adds an offset to the CV > DAC conversion to account for component tolerance etc
+uint8_t clockMul = 1;			// clock multiplier and divider provided by tempo pot when clocked
+uint8_t clockDiv = 1;
 boolean revEnc;					// If true reverse direction of encoder turn
 
 actionOpts actionCVType = ACTSTUTTER;
@@ -58,14 +49,29 @@ actionOpts actionBtnType = ACTPAUSE;
 
 struct CvPatterns cv;
 struct GatePatterns gate;
-struct QuantiseRange quantiseRange[12];
+uint16_t userScales[userScaleCount] = { 0xAB5, 0xAB5 };		// user defined scale note masks - default to major scale
 
-Btn btns[] = { { STEPDN, 22 },{ STEPUP, 12 },{ ENCODER, 15 },{ CHANNEL, 19 },{ ACTIONBTN, 20 },{ ACTIONCV, 21 } };		// numbers refer to Teensy digital pin numbers
+Btn btns[] = { { STEPDN, 22 },{ STEPUP, 12 },{ ENCODER, 15 },{ CHANNEL, 19 },{ ACTIONBTN, 20 },{ ACTIONCV, 21 } };		// numbers refer to Teensy digital pin numbers - ButtonHandler::readPins() reads the same pins from the port registers
 
 ClockHandler clock(minBPM, maxBPM);
+CalibrationHandler calibration;		// corrects the CV > DAC conversion to account for component tolerance etc
+QuantiseHandler quantiser;
+GeneratorHandler generator;
+HistoryHandler history;
+SongHandler song;				// ordered list of patterns played in song mode
+StorageHandler storage;			// journaled EEPROM store for settings, patterns and the song
+PresetHandler presets;			// preset banks of compressed pattern snapshots
+Sequencer sequencer;
 DisplayHandler dispHandler;
 SetupMenu setupMenu;
+MidiHandler midi;				// USB-MIDI clock in and note/CC out
+UndoHandler edits;				// undo and redo of pattern edits
+InputHandler inputs;			// timestamped events from the buttons, encoder and clock
+ButtonHandler buttons;			// debounced button, action CV and encoder events
+SerialHandler usbSerial;			// binary frames to dump and load patterns and stream telemetry over USB
 Encoder myEnc(ENCCLKPIN, ENCDATAPIN);
+IntervalTimer seqTimer;			// runs the sequencer and writes outputs at the time each event is due
+IntervalTimer btnTimer;			// scans the buttons
 
 
 
@@ -73,17 +79,19 @@ void setup() {
 
 	pinMode(LED, OUTPUT);
 	pinMode(GATEOUT, OUTPUT);
+	pinMode(GATEOUT2, OUTPUT);
 	pinMode(CLOCKPIN, INPUT_PULLUP);
+	attachInterrupt(digitalPinToInterrupt(CLOCKPIN), clockPulse, FALLING);
+	midi.begin();
 
 	analogWriteResolution(12);    // set resolution of DAC pin for outputting variable voltages
+	analogWriteFrequency(PWMCV, 11718.75);		// ideal PWM frequency for 12 bit resolution
 
 	// Setup OLED
 	dispHandler.init();
 
 	//	initialise all momentary buttons as Input pullup
-	for (int b = 0; b < 6; b++) {
-		pinMode(btns[b].pin, INPUT_PULLUP);
-	}
+	buttons.begin();
 
 	if (!setupMenu.loadSettings()) {
 		//  Set up CV and Gate patterns
@@ -93,13 +101,16 @@ void setup() {
 			srand(micros());
 			initGateSequence(p, INITRAND, 8);
 		}
+		dirtyRecords = 0;		// random patterns are only saved once something is edited
+	}
+	for (uint8_t t = 0; t < TRACKS; t++) {
+		sequencer.seqNo[t] = sequencer.loopFirst[t];
 	}
-	cvSeqNo = cvLoopFirst;
-	gateSeqNo = gateLoopFirst;
 	makeQuantiseArray();
-
-	// initialise encoder
-	oldEncPos = round(myEnc.read() / 4);
+	sequencer.makeMarkovTables();
+	sequencer.setIdle(editMode == LFO || editMode == NOISE);
+	seqTimer.begin(sequencerTimer, 100);		// output timing resolution in microseconds
+	btnTimer.begin(buttonTimer, ButtonHandler::scanInterval);
 
 	if (editMode == LFO || editMode == NOISE) {
 		dispHandler.updateDisplay();
@@ -108,10 +119,24 @@ void setup() {
 
 void loop() {
 
+	//	MIDI messages queued by the sequencer interrupt are sent here and again between drawing the display frame and sending it to the display
+	midi.send();
+
+	sequencer.setIdle(editMode == LFO || editMode == NOISE);
 	if (editMode == LFO || editMode == NOISE) {
 
-		if (digitalRead(btns[3].pin) == 0 || digitalRead(btns[4].pin) == 0) {
+		//	any other input events while the LFO or noise is running are dropped
+		InputEvent e;
+		boolean leave = 0;
+		while (inputs.get(e)) {
+			if (e.type == INPUTPRESS && (btns[e.source].name == CHANNEL || btns[e.source].name == ACTIONBTN)) {
+				btns[e.source].longClick = 1;		// the release that follows is not a click
+				leave = 1;
+			}
+		}
+		if (leave) {
 			normalMode();
+			setDirty(RECSETTINGS);
 			if (autoSave) {
 				setupMenu.saveSettings();
 			}
@@ -149,17 +174,38 @@ void loop() {
 
 		//  DAC buffer takes values of 0 to 4095 relating to 0v to 3.3v
 		if (editMode == LFO) {
-			analogWrite(DACPIN, round(2047 * (lfoY + 1)));
+			analogWrite(DACPIN, calibration.correct(round(2047 * (lfoY + 1))));
 		}
 		else {
-			analogWrite(DACPIN, round(4095 * getRand()));
+			analogWrite(DACPIN, calibration.correct(round(4095 * getRand())));
 		}
 		digitalWrite(GATEOUT, lfoY > 0);
-		
+
+		setupMenu.saveStep();
+		usbSerial.receive();
 		return;
 	}
 
 
+	//	input events captured by the interrupts are handled in the order they happened
+	InputEvent e;
+	while (inputs.get(e)) {
+		switch (e.type) {
+		case INPUTCLOCK:
+			clock.countPulse(e.time);
+			break;
+		case INPUTENCODER:
+			// check editing mode is valid for selected step type
+			checkEditState();
+			for (uint8_t n = 0; n < abs(e.value); n++) {
+				encoderTurn(revEnc ? e.value < 0 : e.value > 0);
+			}
+			break;
+		default:
+			buttonEvent(e);
+		}
+	}
+
 	//	read value of clock signal if present and set bmp accordingly
 	clockBPM = clock.readClock();
 
@@ -174,540 +220,490 @@ void loop() {
 
 	// work out whether to get bpm from tempo potentiometer or clock signal (checking that we have recieved a recent clock signal)
 	if (clockBPM >= minBPM && clockBPM < maxBPM && clock.hasSignal()) {
-		bpm = clockBPM;
-		// basic clock divider allowing tempo to be halved or doubled depending on position of tempo pot
-		if (tempoPot < 205) {
-			bpm = clockBPM / 4;
-			//Serial.println(clockBPM, 3);
-			clockDiv = "/4";
-		} else if (tempoPot < 410) {
-			bpm = clockBPM / 2;
-			clockDiv = "/2";
-		} else if (tempoPot > 820) {
-			bpm = clockBPM * 4;
-			clockDiv = "x4";
-		} else if (tempoPot > 615) {
-			bpm = clockBPM * 2;
-			clockDiv = "x2";
-		} else {
-			clockDiv = "";
-		}
+		// basic clock divider allowing tempo to be divided or multiplied depending on position of tempo pot
+		clockMul = tempoPot > 820 ? 4 : (tempoPot > 615 ? 2 : 1);
+		clockDiv = tempoPot < 205 ? 4 : (tempoPot < 410 ? 2 : 1);
+		bpm = clockBPM * clockMul / clockDiv;
 		//Serial.print("cl bpm: ");  Serial.print(clockBPM); Serial.print(" tp: ");  Serial.print(tempoPot); Serial.print(" bpm: ");  Serial.println(bpm);
 	}
 	else {
 		bpm = map(tempoPot, 0, 1023, minBPM, maxBPM);        // map(value, fromLow, fromHigh, toLow, toHigh)
-		clockDiv = "";
+		clockMul = clockDiv = 1;
 	}
 
-	//	if clocking provide some leeway for clock being slightly earlier than expected
-	uint8_t lagOffset = clock.hasSignal() ? (300 / bpm) : 0;
-
-	//	check if the sequence counter is ready to advance to the next step. Also if using external clock wait for pulse
-	uint16_t timeStep = 1000 / (((float)bpm / 60) * 2);		// get length of step based on bpm
-
-	boolean newStep = (timeCounter >= timeStep - lagOffset && (!clock.hasSignal() || millis() - clock.clockHighTime < 10));
-
-	//	When the clock is slow relative to the speed of the tempo (usually at 4x clock speed) there won't be a clock tick for every beat
-	if (!newStep && timeCounter >= timeStep && clock.clockInterval + 10 >= timeCounter + timeStep && millis() - clock.clockHighTime > clock.clockInterval / 2) {
-#if DEBUGSTEP
-Serial.println("m-ch: " + String(millis() - clock.clockHighTime) + " ci int: " + String(clock.clockInterval) + " timeStep: " + String(timeStep) + " tc: " + String(timeCounter) + " bpm: " + String(bpm));
-#endif
-		newStep = 1;
-	}	
-
-	boolean newGateStutter = 0;
-	boolean newCVStutter = 0;
-	if (gateStutterStep > 0 && gateStutterStep < gate.seq[gateSeqNo].Steps[gateStep].stutter && !pause) {
-		if (timeCounter >= gateStutterStep * (timeStep / gate.seq[gateSeqNo].Steps[gateStep].stutter) - lagOffset) {
-#if DEBUGSTEP
-			Serial.println("Gate stutter step: " + String(gateStutterStep) + "   ms " + String(millis()) + "  time error: " + String((gateStutterStep * (timeStep / gate.seq[gateSeqNo].Steps[gateStep].stutter) - timeCounter)));
-#endif
-			newGateStutter = 1;
+	//	the sequencer itself is advanced by the timer and clock pin interrupts
+	sequencer.setTempo(bpm, clock.hasSignal());
+	sequencer.setClockRatio(clockMul, clockDiv);
+	sequencer.holdPattern = checkEditing();
+	sequencer.preroll();
+
+	//	generated patterns that are not playing can change straight away - playing patterns change when they next wrap round
+	for (uint8_t p = 0; p < 8; p++) {
+		if (generator.pending(p)) {
+			noInterrupts();
+			if (!sequencer.patternPlaying(SEQGATE, p)) {
+				generator.apply(p);
+			}
+			interrupts();
 		}
 	}
-	if (cvStutterStep > 0 && cvStutterStep < cv.seq[cvSeqNo].Steps[cvStep].stutter && !pause) {
-		if (timeCounter >= cvStutterStep * (timeStep / cv.seq[cvSeqNo].Steps[cvStep].stutter) - lagOffset) {
-#if DEBUGSTEP
-			Serial.println("Cv stutter step: " + String(cvStutterStep) + "   ms " + String(millis()));
-#endif
-			newCVStutter = 1;
+
+	//	a bank recalled from a preset is swapped in whole - straight away if the first track is not playing, otherwise the sequencer swaps it when the first track wraps round
+	noInterrupts();
+	if (presets.armed() && !sequencer.running(0)) {
+		presets.swap();
+		sequencer.makeMarkovTables();
+	}
+	interrupts();
+	uint16_t swapped = presets.takeSwapped();
+	if (swapped) {
+		for (uint8_t p = 0; p < 16; p++) {
+			if ((swapped >> p) & 1) {
+				setDirty((p < 8 ? RECCVPATTERN : RECGATEPATTERN - 8) + p);
+			}
 		}
+		makeQuantiseArray();
 	}
 
-	//	if action button triggers a stutter check which step to activate
-	if (actionStutter) {
-		//if (DEBUGBTNS) { Serial.print("actionStutter: "); Serial.println(actionStutter); }
-		//	divide current step length by stutter count - for now actionStutterNo
-		if (stutterStep == 0) {
-			stutterStep = (timeCounter / (timeStep / actionStutterNo)) + 1;
-			//Serial.println("tc: " + String(timeCounter) + " ts " + String(timeStep));
-		}
-		if (timeCounter >= stutterStep * (timeStep / actionStutterNo) && stutterStep < actionStutterNo && !pause) {
-#if DEBUGSTEP
-			Serial.print("action stutter step: "); Serial.print(stutterStep);  Serial.print(" stutter no: "); Serial.print(actionStutterNo);  Serial.print("   ms ");  Serial.println(millis());
-#endif
-			newGateStutter = 1;
-			newCVStutter = 1;
-		}
+	// outputs are written from interrupts so display updates and saves no longer need to avoid the next step
+	uint32_t m = millis();
+	if (m > 1000) {
+		dispHandler.updateDisplay();
 	}
-	else {
-		stutterStep = 0;
+
+	//	Check if there is a pending save and no edits in the last ten seconds
+	m = millis();
+	if (autoSave && dirtyRecords && m - lastEditing > 10000 && m > 1000) {
+		setupMenu.saveSettings();
 	}
+	setupMenu.saveStep();
+	usbSerial.receive();
+	usbSerial.stream(bpm);
 
+}
 
-	if (!pause && (newStep || newGateStutter || newCVStutter)) {
-		//	increment sequence step and reinitialise stutter steps
-		if (newStep) {
-			cvStep += 1;
-			if (cvStep >= cv.seq[cvSeqNo].steps) {
-				cvStep = 0;
-				if (!checkEditing() && cvLoopLast > cvLoopFirst) {
-					cvSeqNo = cvSeqNo++ >= cvLoopLast ? cvLoopFirst : cvSeqNo;
-					makeQuantiseArray();
-#if DEBUGSTEP
-					Serial.print("CV seq: "); Serial.println(cvSeqNo);
-#endif
+void encoderTurn(boolean upOrDown) {
+	// Handle Encoder turn - alter parameter depending on edit mode
+	if (editMode == SETUP || editMode == SUBMENU) {
+		setupMenu.menuPicker(upOrDown ? ENCUP : ENCDN);
+	}
+	else {
+
+		// change parameter
+		edits.record(trackTypes[activeSeq], sequencer.seqNo[activeSeq], editMode * (MAXSTEPS + 1) + editStep + 1);
+		if (editStep >= 0) {
+
+			if (trackTypes[activeSeq] == SEQCV) {
+				CvSequence *s = &cv.seq[sequencer.seqNo[activeSeq]];
+				if (editMode == STEPV) {
+					if (s->mode == PITCH) {
+						s->volts[editStep] = quantiser.stepNote(sequencer.seqNo[activeSeq], s->volts[editStep], upOrDown);
+					}
+					else {
+						s->volts[editStep] = constrain((int16_t)s->volts[editStep] + (upOrDown ? 82 : -82), 0, 4095);		// 0.1V steps
+					}
+					//Serial.print("Edit volts: "); Serial.println(s->volts[editStep]);
 				}
+				editStepNibbles(s->randAmt, s->stutter, s->nudge, upOrDown);
 			}
-			gateStep += 1;
-			if (gateStep >= gate.seq[gateSeqNo].steps) {
-				gateStep = 0;
-				if (!checkEditing() && gateLoopLast > gateLoopFirst) {
-					gateSeqNo = gateSeqNo++ >= gateLoopLast ? gateLoopFirst : gateSeqNo;
-#if DEBUGSTEP
-					Serial.print("Gate seq: "); Serial.println(gateSeqNo);
-#endif
+			else {
+				GateSequence *s = &gate.seq[sequencer.seqNo[activeSeq]];
+				if (editMode == STEPV) {
+					SetBit(s->on, editStep, !GetBit(s->on, editStep));
+					//Serial.print("Edit gate on: "); Serial.print(GetBit(s->on, editStep));
 				}
+				editStepNibbles(s->randAmt, s->stutter, s->nudge, upOrDown);
 			}
-			cvStutterStep = 0;
-			gateStutterStep = 0;
-			stutterStep = 0;
-#if DEBUGSTEP
-			Serial.println("*** New step.  CV " + String(cvStep) + "  Gate " + String(gateStep) + "  ts " + String(timeStep) + "  BPM " + String(bpm, 2) + "  millis: " + String(millis()));
-#endif
-
 		}
+		else {
 
-		//	guess the next step or stutter time to estimate if we have time to do a refresh
-		guessNextStep = millis() + min(min((gate.seq[gateSeqNo].Steps[gateStep].stutter ? (timeStep / gate.seq[gateSeqNo].Steps[gateStep].stutter) : timeStep),
-			(cv.seq[cvSeqNo].Steps[cvStep].stutter ? (timeStep / cv.seq[cvSeqNo].Steps[cvStep].stutter) : timeStep)),
-			(actionStutter ? (timeStep / actionStutterNo) : timeStep)
-		);
+			//	sequence select mode
+			if (editMode == PATTERN) {
+				uint8_t *seqNo = &sequencer.seqNo[activeSeq];
+				if (trackTypes[activeSeq] == SEQCV) {
+					*seqNo = AddNLoop(*seqNo, upOrDown, 7);
+				}
+				else {
+					*seqNo += upOrDown ? (*seqNo < 7 ? 1 : 0) : *seqNo > 0 ? -1 : 0;
+				}
+				if (sequencer.loopFirst[activeSeq] == sequencer.loopLast[activeSeq]) {
+					sequencer.loopFirst[activeSeq] = sequencer.loopLast[activeSeq] = *seqNo;
+				}
+#if DEBUGBTNS
+				Serial.print("track: "); Serial.print(activeSeq); Serial.print(" pat: "); Serial.print(*seqNo); 
+#endif
+			}
 
-#if DEBUGSTEP
-		Serial.println("guess next step: " + String(guessNextStep) + "  tc: " + String(timeCounter));
+			if (editMode == LOOPFIRST) {
+				uint8_t * loopF = &sequencer.loopFirst[activeSeq];
+				uint8_t * loopL = &sequencer.loopLast[activeSeq];
+				*loopF = AddNLoop(*loopF, upOrDown, 7);
+				*loopL = constrain(*loopL, *loopF, 7);
+#if DEBUGBTNS
+				Serial.print("First loop: ");  Serial.print(*loopF);
 #endif
+			}
 
-		// CV sequence: calculate possible ranges of randomness to ensure we don't try and set a random value out of permitted range
-		if (newStep || newCVStutter || actionStutter) {
-			if (cv.seq[cvSeqNo].Steps[cvStep].stutter > 0 || actionStutter) {
-				if (actionStutter) {
-					cvStutterStep = stutterStep;
-				}
-				cvStutterStep += 1;
-			}
-			if (cv.seq[cvSeqNo].Steps[cvStep].rand_amt) {
-				float randLower = getRandLimit(cv.seq[cvSeqNo].Steps[cvStep], LOWER);
-				float randUpper = getRandLimit(cv.seq[cvSeqNo].Steps[cvStep], UPPER);
-				cvRandVal = constrain(randLower + (getRand() * (randUpper - randLower)), 0, 5);
-#if DEBUGRAND
-				Serial.print("CV  S: "); Serial.print(cvStep);	Serial.print(" V: "); Serial.print(cv.seq[cvSeqNo].Steps[cvStep].volts); Serial.print(" Rnd: "); Serial.println(cv.seq[cvSeqNo].Steps[cvStep].rand_amt);
-				Serial.print("    Lwr: "); Serial.print(randLower); Serial.print(" Upr: "); Serial.print(randUpper); Serial.print(" Result: "); Serial.println(cvRandVal);
+			if (editMode == LOOPLAST) {
+				uint8_t * loopF = &sequencer.loopFirst[activeSeq];
+				uint8_t * loopL = &sequencer.loopLast[activeSeq];
+				*loopL = AddNLoop(*loopL, upOrDown, 7);
+				*loopL = constrain(*loopL, *loopF, 7);
+
+#if DEBUGBTNS
+				Serial.print("Last loop: ");  Serial.print(*loopL);
 #endif
+			}
 
+			//	Sequence mode (gate/trigger or CV/Pitch)
+			if (editMode == SEQMODE) {
+				if (trackTypes[activeSeq] == SEQCV) {
+					cv.seq[sequencer.seqNo[activeSeq]].mode = !cv.seq[sequencer.seqNo[activeSeq]].mode;
+					makeQuantiseArray();
+				}
+				else {
+					gate.seq[sequencer.seqNo[activeSeq]].mode = !gate.seq[sequencer.seqNo[activeSeq]].mode;
+				}
 			}
-			else {
-				cvRandVal = cv.seq[cvSeqNo].Steps[cvStep].volts;
+
+			//	Steps select mode
+			if (editMode == STEPS) {
+				if (trackTypes[activeSeq] == SEQCV) {
+					cv.seq[sequencer.seqNo[activeSeq]].steps = constrain(cv.seq[sequencer.seqNo[activeSeq]].steps + (upOrDown ? 1 : -1), 1, MAXSTEPS);
+				} else {
+					gate.seq[sequencer.seqNo[activeSeq]].steps = constrain(gate.seq[sequencer.seqNo[activeSeq]].steps + (upOrDown ? 1 : -1), 1, MAXSTEPS);
+				}
 			}
-			setCV(cvRandVal);
-		}
 
-		// Gate sequence: calculate probability of gate being high or low. Eg rand_amt = 9 means there is a 90% chance that the value will be randomised
-		if (newStep || newGateStutter || actionStutter) {
+			//	Initialise/randomise sequence mode - simple menu system
+			if (editMode == SEQOPT) {
+				submenuVal = AddNLoop(submenuVal, upOrDown, (trackTypes[activeSeq] == SEQCV ? initCVSeqSize - 1 : initGateSeqSize - 1));
+			} 
+
+			//	Pitch mode root and scale selection
+			if (editMode == SEQROOT) {
+				cv.seq[sequencer.seqNo[activeSeq]].root = AddNLoop(cv.seq[sequencer.seqNo[activeSeq]].root, upOrDown, 11);
+				makeQuantiseArray();
+			}
+			if (editMode == SEQSCALE) {
+				cv.seq[sequencer.seqNo[activeSeq]].scale = AddNLoop(cv.seq[sequencer.seqNo[activeSeq]].scale, upOrDown, scaleSize - 1);
+				makeQuantiseArray();
+			}
+			if (editMode == SEQTUNING) {
+				cv.seq[sequencer.seqNo[activeSeq]].tuning = AddNLoop(cv.seq[sequencer.seqNo[activeSeq]].tuning, upOrDown, tuningSize - 1);
+				makeQuantiseArray();
+			}
+			if (editMode == SCALEEDIT) {
+				submenuVal = AddNLoop(submenuVal, upOrDown, 12);		// 0-11 select note of user scale; 12 to finish editing
+			}
 
-			if (gate.seq[gateSeqNo].Steps[gateStep].stutter > 0 || actionStutter) {
-				if (actionStutter) {
-					gateStutterStep = stutterStep;
-					
+			//	Track clock ratio and direction
+			if (editMode == SEQRATIO) {
+				// move to the next ratio in the preset list (ratios not in the list start from 1:1)
+				int8_t r = trackRatioSize / 2;
+				for (uint8_t i = 0; i < trackRatioSize; i++) {
+					if (trackRatios[i][0] == sequencer.ratioMul[activeSeq] && trackRatios[i][1] == sequencer.ratioDiv[activeSeq]) {
+						r = i;
+					}
 				}
-				gateStutterStep += 1;
-				gateRandVal = ((gateStutterStep + (gate.seq[gateSeqNo].Steps[gateStep].on ? 0 : 1)) % 2 > 0);
-				
-				// if randomising mute 'on' stutters according to probablility setting
-				if (gate.seq[gateSeqNo].Steps[gateStep].rand_amt && gateRandVal && getRand() * 14 < gate.seq[gateSeqNo].Steps[gateStep].rand_amt) {
-					gateRandVal = 0;
+				r = constrain(r + (upOrDown ? 1 : -1), 0, trackRatioSize - 1);
+				sequencer.ratioMul[activeSeq] = trackRatios[r][0];
+				sequencer.ratioDiv[activeSeq] = trackRatios[r][1];
+			}
+			if (editMode == SEQDIR) {
+				sequencer.direction[activeSeq] = AddNLoop(sequencer.direction[activeSeq], upOrDown, directionSize - 1);
+			}
+			//	Gate generator hits (or grid spacing) and rotation
+			if (editMode == GENFILL || editMode == GENROTATE) {
+				uint8_t p = sequencer.seqNo[activeSeq];
+				if (editMode == GENFILL) {
+					generator.fill[p] = constrain(generator.fill[p] + (upOrDown ? 1 : -1), generator.type[p] == GENGRID ? 1 : 0, gate.seq[p].steps);
 				}
-#if DEBUGSTEP
-				//Serial.println("Gate step: " + String(gateStep) + " grv: " + String(gateRandVal) + " gss: " + String(gateStutterStep));
-#endif
+				else {
+					generator.rotate[p] = AddNLoop(generator.rotate[p] % gate.seq[p].steps, upOrDown, gate.seq[p].steps - 1);
+				}
+				generator.request(p);
 			}
-			else {
-				if (gate.seq[gateSeqNo].Steps[gateStep].rand_amt) {
-					uint8_t rndXTen = getRand() * 10;
-					float r = getRand();
-					gateRandVal = (gate.seq[gateSeqNo].Steps[gateStep].rand_amt > rndXTen && r < 0.5) ? !gate.seq[gateSeqNo].Steps[gateStep].on : gate.seq[gateSeqNo].Steps[gateStep].on;
-
-#if DEBUGRAND
-					Serial.print("GT on: "); Serial.print(gate.seq[gateSeqNo].Steps[gateStep].on); Serial.print(" prb: "); Serial.print(gate.seq[gateSeqNo].Steps[gateStep].rand_amt); Serial.print(" > rand: "); Serial.print(rndXTen);
-					Serial.print(" Gate: "); Serial.print(r); Serial.print(" changed: "); Serial.println(gate.seq[gateSeqNo].Steps[gateStep].on != gateRandVal);
-#endif
+			if (editMode == SEQMARKOV) {
+				uint8_t *weights = trackTypes[activeSeq] == SEQCV ? &cv.seq[sequencer.seqNo[activeSeq]].markov : &gate.seq[sequencer.seqNo[activeSeq]].markov;
+				uint8_t w = constrain(((*weights >> (submenuVal * 2)) & 3) + (upOrDown ? 1 : -1), 0, 3);
+				*weights = (*weights & ~(3 << (submenuVal * 2))) | (w << (submenuVal * 2));
+				sequencer.makeMarkovTables();
+			}
+			//	Random history lock and mutate chance
+			if (editMode == SEQLOCK) {
+				history.toggleLock(trackTypes[activeSeq], sequencer.seqNo[activeSeq]);
+			}
+			if (editMode == SEQMUTATE) {
+				uint8_t *mutate = &history.mutate[trackTypes[activeSeq]][sequencer.seqNo[activeSeq]];
+				*mutate = constrain(*mutate + (upOrDown ? 1 : -1), 0, 10);
+			}
+			//	Ratchet shape and gate length or CV ramp
+			if (editMode == SEQRATCHET) {
+				int8_t *curve = trackTypes[activeSeq] == SEQCV ? &cv.seq[sequencer.seqNo[activeSeq]].ratchetCurve : &gate.seq[sequencer.seqNo[activeSeq]].ratchetCurve;
+				*curve = constrain(*curve + (upOrDown ? 1 : -1), -RATCHETCURVE, RATCHETCURVE);
+			}
+			if (editMode == SEQRATCHETLEN) {
+				if (trackTypes[activeSeq] == SEQCV) {
+					cv.seq[sequencer.seqNo[activeSeq]].ratchetRamp = upOrDown;
 				}
 				else {
-					gateRandVal = gate.seq[gateSeqNo].Steps[gateStep].on;
+					int8_t *length = &gate.seq[sequencer.seqNo[activeSeq]].ratchetGate;
+					*length = constrain(*length + (upOrDown ? 1 : -1), -1, 2);
 				}
-
 			}
-			digitalWrite(GATEOUT, gateRandVal);
-			if (gate.seq[gateSeqNo].mode == TRIGGER && gateRandVal) {
-				lastGate = millis();
-#if DEBUGSTEP
-				Serial.println("Gate off - trigger mode"); 
-#endif
+			if (editMode == SEQSWING) {
+				uint8_t *swing = trackTypes[activeSeq] == SEQCV ? &cv.seq[sequencer.seqNo[activeSeq]].swing : &gate.seq[sequencer.seqNo[activeSeq]].swing;
+				*swing = constrain(*swing + (upOrDown ? 1 : -1), 0, swingSize);		// 0 follows the global swing
 			}
 
 		}
-
-		if (newStep || gateStutterStep > 0 || cvStutterStep > 0 || actionStutter) {
-			stutterStep += 1;
+		lastEditing = millis();
+		if (editStep < 0 && (editMode == PATTERN || editMode == LOOPFIRST || editMode == LOOPLAST || editMode == SEQRATIO || editMode == SEQDIR)) {
+			setDirty(RECSETTINGS);		// loops, clock ratios and directions are saved with the settings
 		}
-
-		//  reset step info and flash LED
-		if (newStep) {
-			//digitalWrite(LED, cvStep % 2 == 0 ? HIGH : LOW);
-			timeCounter = 0;
-			newStep = 0;
+		else if (editStep >= 0 || (editMode != SEQOPT && editMode != SCALEEDIT && editMode != SEQLOCK && editMode != SEQMUTATE)) {
+			setDirty((trackTypes[activeSeq] == SEQCV ? RECCVPATTERN : RECGATEPATTERN) + sequencer.seqNo[activeSeq]);
 		}
 	}
-	else if (gate.seq[gateSeqNo].mode == TRIGGER && gateRandVal && lastGate > 0 && lastGate < millis() - 10) {
-		digitalWrite(GATEOUT, 0);
-		lastGate = 0;
-	}
-
-
-	// Handle Encoder turn - alter parameter depending on edit mode
-	long newEncPos = myEnc.read();
-	if (newEncPos != oldEncPos) {
-
-		// check editing mode is valid for selected step type
-		checkEditState();
-		if (round(newEncPos / 4) != round(oldEncPos / 4)) {
-			boolean upOrDown = revEnc ? newEncPos < oldEncPos : newEncPos > oldEncPos;
-
-			if (editMode == SETUP || editMode == SUBMENU) {
-				setupMenu.menuPicker(upOrDown ? ENCUP : ENCDN);
-			}
-			else {
-
-				// change parameter
-				if (editStep >= 0) {
-
-					if (activeSeq == SEQCV) {
-						CvStep *s = &cv.seq[cvSeqNo].Steps[editStep];
-						if (editMode == STEPV) {
-							if (cv.seq[cvSeqNo].mode == PITCH) {
-								float n = s->volts + (upOrDown ? 0.08333 : -0.08333);
-								while (round(quantiseVolts(n) * 100) == round(quantiseVolts(s->volts) * 100)) {
-									n += (upOrDown ? 0.08333 : -0.08333);
-								}
-								s->volts = quantiseVolts(n);
-							}
-							else {
-								s->volts += upOrDown ? 0.10 : -0.10;
-							}
-							s->volts = constrain(s->volts, 0, 5);
-							//Serial.print("Edit volts: "); Serial.println(s->volts);
-						}
-						if (editMode == STEPR && (upOrDown || s->rand_amt > 0) && (!upOrDown || s->rand_amt < 10)) {
-							s->rand_amt += upOrDown ? 1 : -1;
-							//Serial.print("Edit cv rand: "); Serial.println(s->rand_amt);
-						}
-						if (editMode == STUTTER && (upOrDown || s->stutter > 0) && (!upOrDown || s->stutter < 8)) {
-							s->stutter += upOrDown ? (s->stutter == 0 ? 2 : 1) : (s->stutter == 2 ? -2 : -1);
-							//Serial.print("Edit cv stutter: "); Serial.println(s->stutter);
-						}
-					}
-					else {
-						GateStep *s = &gate.seq[gateSeqNo].Steps[editStep];
-						if (editMode == STEPV) {
-							s->on = !s->on;
-							//Serial.print("Edit gate on: "); Serial.print(s->on);
-						}
-						if (editMode == STEPR && (upOrDown || s->rand_amt > 0) && (!upOrDown || s->rand_amt < 10)) {
-							s->rand_amt += upOrDown ? 1 : -1;
-							//Serial.print("Edit gate rand: "); Serial.print(s->rand_amt);
-						}
-						if (editMode == STUTTER && (upOrDown || s->stutter > 0) && (!upOrDown || s->stutter < 8)) {
-							s->stutter += upOrDown ? (s->stutter == 0 ? 2 : 1) : (s->stutter == 2 ? -2 : -1);
-							//Serial.print("Edit gate stutter: "); Serial.print(s->stutter);
-						}
-					}
-				}
-				else {
-
-					//	sequence select mode
-					if (editMode == PATTERN) {
-						if (activeSeq == SEQCV) {
-							cvSeqNo = AddNLoop(cvSeqNo, upOrDown, 7);
-							if (cvLoopFirst == cvLoopLast) {
-								cvLoopFirst = cvLoopLast = cvSeqNo;
-							}
-							makeQuantiseArray();
-						}
-						else {
-							gateSeqNo += upOrDown ? (gateSeqNo < 7 ? 1 : 0) : gateSeqNo > 0 ? -1 : 0;
-							if (gateLoopFirst == gateLoopLast) {
-								gateLoopFirst = gateSeqNo;
-								gateLoopLast = gateSeqNo;
-							}
-						}
 #if DEBUGBTNS
-						Serial.print("cv pat: "); Serial.print(cvSeqNo); Serial.print(" gate: "); Serial.print(gateSeqNo); 
+	Serial.print("  Encoder: ");  Serial.println(upOrDown);
 #endif
-					}
-
-					if (editMode == LOOPFIRST) {
-						uint8_t * loopF = activeSeq == SEQCV ? &cvLoopFirst : &gateLoopFirst;
-						uint8_t * loopL = activeSeq == SEQCV ? &cvLoopLast : &gateLoopLast;
-						*loopF = AddNLoop(*loopF, upOrDown, 7);
-						*loopL = constrain(*loopL, *loopF, 7);
-#if DEBUGBTNS
-						Serial.print("First loop: ");  Serial.print(*loopF);
-#endif
-					}
-
-					if (editMode == LOOPLAST) {
-						uint8_t * loopF = activeSeq == SEQCV ? &cvLoopFirst : &gateLoopFirst;
-						uint8_t * loopL = activeSeq == SEQCV ? &cvLoopLast : &gateLoopLast;
-						*loopL = AddNLoop(*loopL, upOrDown, 7);
-						*loopL = constrain(*loopL, *loopF, 7);
+}
 
+void buttonEvent(const InputEvent &e) {
+	//  Parameter button handler - press, release and long press of btns[e.source]
+	uint8_t b = e.source;
+	if (e.type == INPUTRELEASE) {
+		// Handle buttons that activate on release rather than click
+		if (btns[b].name == CHANNEL && !btns[b].longClick) {
 #if DEBUGBTNS
-						Serial.print("Last loop: ");  Serial.print(*loopL);
+			Serial.println("Btn: Channel");
 #endif
-					}
-
-					//	Sequence mode (gate/trigger or CV/Pitch)
-					if (editMode == SEQMODE) {
-						if (activeSeq == SEQCV) {
-							cv.seq[cvSeqNo].mode = !cv.seq[cvSeqNo].mode;
-							makeQuantiseArray();
-						}
-						else {
-							gate.seq[gateSeqNo].mode = !gate.seq[gateSeqNo].mode;
-						}
-					}
-
-					//	Steps select mode
-					if (editMode == STEPS) {
-						if (activeSeq == SEQCV) {
-							cv.seq[cvSeqNo].steps = constrain(cv.seq[cvSeqNo].steps + (upOrDown ? 1 : -1), 1, 8);
-						} else {
-							gate.seq[gateSeqNo].steps = constrain(gate.seq[gateSeqNo].steps + (upOrDown ? 1 : -1), 1, 8);
-						}
-					}
-
-					//	Initialise/randomise sequence mode - simple menu system
-					if (editMode == SEQOPT) {
-						submenuVal = AddNLoop(submenuVal, upOrDown, (activeSeq == SEQCV ? initCVSeqSize - 1 : initGateSeqSize - 1));
-					} 
-
-					//	Pitch mode root and scale selection
-					if (editMode == SEQROOT) {
-						cv.seq[cvSeqNo].root = AddNLoop(cv.seq[cvSeqNo].root, upOrDown, 11);
-						makeQuantiseArray();
-					}
-					if (editMode == SEQSCALE) {
-						cv.seq[cvSeqNo].scale = AddNLoop(cv.seq[cvSeqNo].scale, upOrDown, scaleSize - 1);
-						makeQuantiseArray();
-					}
-
-				}
-				lastEditing = millis();
-				saveRequired = 1;
+			if (editMode == SETUP) {
+				normalMode();
 			}
-#if DEBUGBTNS
-			Serial.print("  Encoder: ");  Serial.println(newEncPos);
-#endif
-		}
-		oldEncPos = newEncPos;
-	}
-
-
-	for (int b = 0; b < 6; b++) {
-		//  Parameter button handler - digitalRead returns 0 when button down
-		if (digitalRead(btns[b].pin)) {
-			if (btns[b].pressed == 1) {
-				btns[b].released = 1;
+			else {
+				activeSeq = AddNLoop(activeSeq, 1, TRACKS - 1);
+				lastEditing = 0;
 			}
-			btns[b].pressed = 0;
+		}
 
-			// Handle buttons that activate on release rather than click
-			if (btns[b].released && btns[b].name == CHANNEL) {
-				btns[b].released = 0;
-				if (millis() - btns[b].lastPressed < 500) {
+		if (btns[b].name == ACTIONBTN || btns[b].name == ACTIONCV) {
+			sequencer.actionStutter = 0;
 #if DEBUGBTNS
-					Serial.println("Btn: Channel");
+			Serial.println("Stutter off");
 #endif
-					if (editMode == SETUP) {
-						normalMode();
-					}
-					else {
-						activeSeq = (activeSeq == SEQGATE ? SEQCV : SEQGATE);
-						lastEditing = 0;
-					}
-				}
-			}
-
-			if (btns[b].released && (btns[b].name == ACTIONBTN || btns[b].name == ACTIONCV)) {
-				btns[b].released = 0;
-				actionStutter = 0;
+		}
+		btns[b].longClick = 0;
+	}
+	else if (e.type == INPUTLONG) {
+		//	Handle long click on the channel button to enter setup menu
+		if (btns[b].name == CHANNEL) {
+			btns[b].longClick = 1;
+			if (editMode != SETUP) {
+				editMode = SETUP;
 #if DEBUGBTNS
-				Serial.println("Stutter off");
+				Serial.println("Setup");
 #endif
 			}
 		}
+	}
+	else {
+		if (btns[b].name != ACTIONBTN && btns[b].name != ACTIONCV && (editMode == SETUP || editMode == SUBMENU)) {
+			setupMenu.menuPicker(btns[b].name);
+		}
 		else {
-			//  check if button has been pressed (previous state off and over x milliseconds since last on)
-			if (btns[b].pressed == 0 && millis() - btns[b].lastPressed > 10) {
-
-				if (btns[b].name != ACTIONBTN && btns[b].name != ACTIONCV && (editMode == SETUP || editMode == SUBMENU)) {
-					setupMenu.menuPicker(btns[b].name);
+			if (btns[b].name == STEPUP || btns[b].name == STEPDN) {
+				//	step through to the end of the last page of the active pattern so unplayed steps on that page can still be edited
+				int8_t lastStep = (((sequencer.trackSteps(activeSeq) + 7) / 8) * 8) - 1;
+				editStep = editStep + (btns[b].name == STEPUP ? 1 : -1);
+				editStep = (editStep > lastStep ? -1 : (editStep < -1 ? lastStep : editStep));
+
+				if (editStep > -1 && (btns[b].name == STEPUP || btns[b].name == STEPDN || btns[b].name == ENCODER)) {
+					lastEditing = millis();
 				}
-				else {
-					if (btns[b].name == STEPUP || btns[b].name == STEPDN) {
-						editStep = editStep + (btns[b].name == STEPUP ? 1 : -1);
-						editStep = (editStep > 7 ? -1 : (editStep < -1 ? 7 : editStep));
 
-						if (editStep > -1 && (btns[b].name == STEPUP || btns[b].name == STEPDN || btns[b].name == ENCODER)) {
+				// check editing mode is valid for selected step type
+				checkEditState();
+
+				//	pressing step down while holding step up undoes the last pattern edit and step up while holding step down redoes it - the two presses cancel out on the edit step
+				for (uint8_t o = 0; o < 6; o++) {
+					if (buttons.held(o) && btns[o].name == (btns[b].name == STEPUP ? STEPDN : STEPUP)) {
+						if ((btns[b].name == STEPDN ? edits.undo() : edits.redo()) >= 0) {
+							makeQuantiseArray();
+							sequencer.makeMarkovTables();
 							lastEditing = millis();
 						}
-
-						// check editing mode is valid for selected step type
-						checkEditState();
+					}
+				}
 
 #if DEBUGBTNS
-							if (btns[STEPUP].pressed) Serial.println("Btn: Step up");
-							if (btns[STEPDN].pressed) Serial.println("Btn: Step dn");
+					Serial.println(btns[b].name == STEPUP ? "Btn: Step up" : "Btn: Step dn");
 #endif
-					}
+			}
 
-					if (btns[b].name == ACTIONBTN || btns[b].name == ACTIONCV) {
-						actionOpts actionType = btns[b].name == ACTIONBTN ? actionBtnType : actionCVType;
+			if (btns[b].name == ACTIONBTN || btns[b].name == ACTIONCV) {
+				actionOpts actionType = btns[b].name == ACTIONBTN ? actionBtnType : actionCVType;
 #if DEBUGBTNS
-						Serial.print("Btn: Action; type: "); Serial.println(actionType);
+				Serial.print("Btn: Action; type: "); Serial.println(actionType);
 #endif
 
-						switch (actionType) {
-						case ACTSTUTTER:
-							actionStutter = 1;
-							break;
-						case ACTRESTART:
-							cvStep = 0;
-							gateStep = 0;
-							break;
-						case ACTPAUSE:
-							pause = !pause;
-							// ensure gate is off when pausing
-							if (pause) {
-								digitalWrite(GATEOUT, 0);
-							}
-							break;
-						}
-					}
+				switch (actionType) {
+				case ACTSTUTTER:
+					sequencer.actionStutterStart(e.time);
+					break;
+				case ACTRESTART:
+					sequencer.actionRestart(e.time);
+					break;
+				case ACTPAUSE:
+					sequencer.togglePause();
+					break;
+				case ACTLOCK:
+					history.toggleLock(trackTypes[activeSeq], sequencer.seqNo[activeSeq]);
+					break;
+				}
+			}
 
 
-					if (btns[b].name == ENCODER) {
+			if (btns[b].name == ENCODER) {
 #if DEBUGBTNS
-						Serial.println("Btn: Encoder");
+				Serial.println("Btn: Encoder");
 #endif
-						if (checkEditing()) {
-							switch (editMode) {
-							case STEPV:
-								editMode = STEPR;
-								break;
-							case STEPR:
-								editMode = STUTTER;
-								break;
-							case STUTTER:
-								editMode = STEPV;
-								break;
-							case PATTERN:
-								editMode = SEQMODE;
-								break;
-							case SEQMODE:
-								editMode = STEPS;
-								break;	
-							case STEPS:
-								editMode = LOOPFIRST;
-								break;
-							case LOOPFIRST:
-								editMode = LOOPLAST;
-								break;
-							case LOOPLAST:
-								editMode = SEQOPT;
-								break;
-							case SEQOPT:
-								if (submenuVal == 0) {
-									editMode = (activeSeq == SEQCV && cv.seq[cvSeqNo].mode == PITCH) ? SEQROOT : SEQMODE;
-								} else  {		// initSeq[] = { "None", "All", "Vals", "Blank", "High", "Med", "Low" };
-									activeSeq == SEQCV ? initCvSequence(cvSeqNo, (seqInitType)submenuVal, cv.seq[cvSeqNo].steps) : initGateSequence(gateSeqNo, (seqInitType)submenuVal, gate.seq[gateSeqNo].steps);
-								}
-								break;
-							case SEQROOT:
-								editMode = SEQSCALE;
-								break;
-							case SEQSCALE:
-								editMode = SEQMODE;
-								break;
-							case SETUP:
-								break;
-							case SUBMENU:
-								break;
-							case LFO:
-								break;
-							case NOISE:
-								break;
+				if (checkEditing()) {
+					switch (editMode) {
+					case STEPV:
+						editMode = STEPR;
+						break;
+					case STEPR:
+						editMode = STUTTER;
+						break;
+					case STUTTER:
+						editMode = STEPNUDGE;
+						break;
+					case STEPNUDGE:
+						editMode = STEPV;
+						break;
+					case PATTERN:
+						editMode = SEQMODE;
+						break;
+					case SEQMODE:
+						editMode = STEPS;
+						break;	
+					case STEPS:
+						editMode = LOOPFIRST;
+						break;
+					case LOOPFIRST:
+						editMode = LOOPLAST;
+						break;
+					case LOOPLAST:
+						editMode = SEQOPT;
+						break;
+					case SEQOPT:
+						if (submenuVal == 0) {
+							editMode = (trackTypes[activeSeq] == SEQCV && cv.seq[sequencer.seqNo[activeSeq]].mode == PITCH) ? SEQROOT : SEQRATIO;
+						}
+						else if (trackTypes[activeSeq] == SEQGATE && submenuVal >= initGenFirst) {
+							generator.type[sequencer.seqNo[activeSeq]] = submenuVal - initGenFirst;
+							generator.request(sequencer.seqNo[activeSeq]);
+							editMode = GENFILL;
+						}
+						else {		// initSeq[] = { "None", "All", "Vals", "Blank", "High", "Med", "Low" };
+							edits.record(trackTypes[activeSeq], sequencer.seqNo[activeSeq], SEQOPT * (MAXSTEPS + 1));
+							trackTypes[activeSeq] == SEQCV ? initCvSequence(sequencer.seqNo[activeSeq], (seqInitType)submenuVal, sequencer.trackSteps(activeSeq)) : initGateSequence(sequencer.seqNo[activeSeq], (seqInitType)submenuVal, sequencer.trackSteps(activeSeq));
+							edits.commit();
+						}
+						break;
+					case SEQROOT:
+						editMode = SEQSCALE;
+						break;
+					case SEQSCALE:
+						if (cv.seq[sequencer.seqNo[activeSeq]].scale >= userScaleFirst) {
+							editMode = SCALEEDIT;
+							submenuVal = 0;
+						}
+						else {
+							editMode = SEQTUNING;
+						}
+						break;
+					case SCALEEDIT:
+						if (submenuVal == 12) {
+							editMode = SEQTUNING;
+							submenuVal = 0;
+						}
+						else {
+							// toggle selected note in or out of user scale - at least one note must remain
+							uint16_t *mask = &userScales[cv.seq[sequencer.seqNo[activeSeq]].scale - userScaleFirst];
+							if (*mask ^ (1 << submenuVal)) {
+								*mask ^= 1 << submenuVal;
+								makeQuantiseArray();
+								setDirty(RECSETTINGS);
 							}
 						}
+						break;
+					case SEQTUNING:
+						editMode = SEQRATIO;
+						break;
+					case SEQRATIO:
+						editMode = SEQDIR;
+						break;
+					case SEQDIR:
+						editMode = sequencer.direction[activeSeq] == DIRMARKOV ? SEQMARKOV : SEQSWING;
+						submenuVal = 0;
+						break;
+					case SEQMARKOV:
+						// click through the weight of each jump
+						if (submenuVal < markovJumpSize - 1) {
+							submenuVal++;
+						}
 						else {
-							// if not currently editing initialise to first step of editing menu
-							editMode = editStep == -1 ? SEQMODE : STEPV;
+							editMode = SEQSWING;
 							submenuVal = 0;
 						}
-
-						lastEditing = millis();
+						break;
+					case SEQSWING:
+						editMode = SEQLOCK;
+						break;
+					case SEQLOCK:
+						editMode = SEQMUTATE;
+						break;
+					case SEQMUTATE:
+						editMode = SEQRATCHET;
+						break;
+					case SEQRATCHET:
+						editMode = SEQRATCHETLEN;
+						break;
+					case SEQRATCHETLEN:
+						editMode = SEQMODE;
+						break;
+					case GENFILL:
+						editMode = GENROTATE;
+						break;
+					case GENROTATE:
+						editMode = SEQMODE;
+						submenuVal = 0;
+						break;
+					case SETUP:
+						break;
+					case SUBMENU:
+						break;
+					case LFO:
+						break;
+					case NOISE:
+						break;
 					}
-
 				}
-				btns[b].lastPressed = millis();
-			}
-			btns[b].pressed = 1;
-		}
-	}
-
-	//	Handle long click on the channel button to enter setup menu
-	if (btns[CHANNEL].pressed && millis() - btns[CHANNEL].lastPressed > 500 && editMode != SETUP) {
-		btns[CHANNEL].longClick = 1;
-		editMode = SETUP;
-#if DEBUGBTNS
-		Serial.println("Setup");
-#endif
-		
-	}
+				else {
+					// if not currently editing initialise to first step of editing menu
+					editMode = editStep == -1 ? SEQMODE : STEPV;
+					submenuVal = 0;
+				}
 
-	// about the longest display update time is 2 milliseconds so don't update display if less than 5 milliseconds until the next expected event (step change or clock tick)
-	uint32_t m = millis();
-	if (m > 1000 && guessNextStep - m > 5 && clock.clockHighTime + clock.clockInterval - m > 5) {
-		dispHandler.updateDisplay();
-	}
+				lastEditing = millis();
+			}
 
-	//	Check if there is a pending save and no edits in the last ten seconds
-	m = millis();
-	if (autoSave && saveRequired && m - lastEditing > 10000 && m > 1000 && guessNextStep - m > 5 && clock.clockHighTime + clock.clockInterval - m > 5) {
-		Serial.println("Autosave triggered");
-		setupMenu.saveSettings();
+		}
 	}
-
 }
 
 
@@ -717,88 +713,120 @@ Serial.println("m-ch: " + String(millis() - clock.clockHighTime) + " ci int: " +
 
 
 
+void setDirty(uint8_t record) {
+	dirtyRecords |= 1UL << record;
+}
+
 double getRand() {
 	return (double)rand() / (double)RAND_MAX;
 }
 
 void initCvSequence(int seqNum, seqInitType initType, uint16_t numSteps = 8) {
-	numSteps = (numSteps == 0 || numSteps > 8 ? 8 : numSteps);
+	numSteps = (numSteps == 0 || numSteps > MAXSTEPS ? 8 : numSteps);
 	cv.seq[seqNum].steps = numSteps;
-	for (int s = 0; s < 8; s++) {
+	setDirty(RECCVPATTERN + seqNum);
+	for (int s = 0; s < MAXSTEPS; s++) {
 		// INITNONE, INITRAND, INITVALS, INITBLANK, INITHIGH, INITMEDIUM, INITLOW
 		if (initType == INITHIGH || initType == INITMEDIUM || initType == INITLOW) {
-			cv.seq[seqNum].Steps[s].volts = 0.5 + (initType == INITMEDIUM ? 1 : (initType == INITHIGH ? 2 : 0)) + (getRand() * 1.5);
-			cv.seq[seqNum].Steps[s].rand_amt = round(getRand() * 3);
+			cv.seq[seqNum].volts[s] = VoltsToCode(0.5 + (initType == INITMEDIUM ? 1 : (initType == INITHIGH ? 2 : 0)) + (getRand() * 1.5));
+			SetNibble(cv.seq[seqNum].randAmt, s, round(getRand() * 3));
 		}
 		else {
-			cv.seq[seqNum].Steps[s].volts = (initType == INITBLANK ? 2.5 : getRand() * 5);
-			cv.seq[seqNum].Steps[s].rand_amt = (initType == INITRAND ? round((getRand() * 10)) : 0);
+			cv.seq[seqNum].volts[s] = VoltsToCode(initType == INITBLANK ? 2.5 : getRand() * 5);
+			SetNibble(cv.seq[seqNum].randAmt, s, (initType == INITRAND ? round((getRand() * 10)) : 0));
 		}
 
 		//	Don't want too many stutters so apply two random checks to see if apply stutter, and if so how much - minimum number of stutters is 2
 		if (initType == INITRAND && getRand() > 0.8) {
-			cv.seq[seqNum].Steps[s].stutter = round((getRand() * 6) + 1);
+			SetNibble(cv.seq[seqNum].stutter, s, round((getRand() * 6) + 1));
 		}
 		else {
-			cv.seq[seqNum].Steps[s].stutter = 0;
+			SetNibble(cv.seq[seqNum].stutter, s, 0);
 		}
 	}
 }
 
 void initGateSequence(int seqNum, seqInitType initType, uint16_t numSteps = 8) {
-	numSteps = (numSteps == 0 || numSteps > 8 ? 8 : numSteps);
+	numSteps = (numSteps == 0 || numSteps > MAXSTEPS ? 8 : numSteps);
 	gate.seq[seqNum].steps = numSteps;
-	for (int s = 0; s < 8; s++) {
-		gate.seq[seqNum].Steps[s].on = (initType == INITBLANK ? 0 : round(getRand()));
-		gate.seq[seqNum].Steps[s].rand_amt = (initType == INITRAND ? round((getRand() * 10)) : 0);
-		//	Don't want too many stutters so apply two random checks to see if apply stutter, and if so how much
+	setDirty(RECGATEPATTERN + seqNum);
+	for (int s = 0; s < MAXSTEPS; s++) {
+		SetBit(gate.seq[seqNum].on, s, (initType == INITBLANK ? 0 : round(getRand())));
+		SetNibble(gate.seq[seqNum].randAmt, s, (initType == INITRAND ? round((getRand() * 10)) : 0));
+		//	Don't want too many ratchets so apply two random checks to see if apply ratchets, and if so how many
 		if (initType == INITRAND && getRand() > 0.8) {
-			gate.seq[seqNum].Steps[s].stutter = round((getRand() * 6) + 1);
+			SetNibble(gate.seq[seqNum].stutter, s, round((getRand() * 3) + 1));
 		}
 		else {
-			gate.seq[seqNum].Steps[s].stutter = 0;
+			SetNibble(gate.seq[seqNum].stutter, s, 0);
 		}
 	}
 }
 
-void setCV(float setVolt) {
-	//  DAC buffer takes values of 0 to 4095 relating to 0v to 3.3v
-	//  setVolt will be in range 0 - voltsMax (5 unless trying to do pitch which might need negative)
-	if (cv.seq[cvSeqNo].mode == PITCH) {
-		setVolt = quantiseVolts(setVolt);
+void editStepNibbles(uint8_t *randAmt, uint8_t *stutter, uint8_t *nudge, boolean upOrDown) {
+	//	alter the random amount, stutter count or nudge of the step being edited in a cv or gate pattern - nudges are shared by the same position on each 8 step page
+	uint8_t r = GetNibble(randAmt, editStep);
+	if (editMode == STEPR && (upOrDown || r > 0) && (!upOrDown || r < 10)) {
+		SetNibble(randAmt, editStep, r + (upOrDown ? 1 : -1));
+		//Serial.print("Edit rand: "); Serial.println(GetNibble(randAmt, editStep));
+	}
+	uint8_t st = GetNibble(stutter, editStep);
+	if (editMode == STUTTER && (upOrDown || st > 0) && (!upOrDown || st < 15)) {
+		SetNibble(stutter, editStep, st + (upOrDown ? (st == 0 ? 2 : 1) : (st == 2 ? -2 : -1)));
+		//Serial.print("Edit stutter: "); Serial.println(GetNibble(stutter, editStep));
+	}
+	int8_t n = SignedNibble(GetNibble(nudge, editStep & 7));
+	if (editMode == STEPNUDGE && (upOrDown || n > -7) && (!upOrDown || n < 7)) {
+		SetNibble(nudge, editStep & 7, n + (upOrDown ? 1 : -1));
 	}
-	float dacVolt = (setVolt / 5 * 4095) + cvOffset;
-	analogWrite(DACPIN, (int)dacVolt);
 }
 
+void clockPulse() {
+	//	clock pin interrupt - the sequencer follows each pulse as it arrives so swing and nudges stay in time with the external clock
+	uint32_t t = micros();
+	if (clock.onPulse(t, SOURCEPIN)) {
+		sequencer.onClock(t, clock.ppqn);
+	}
+}
 
+void buttonTimer() {
+	buttons.scan();
+}
 
-float quantiseVolts(float v) {
-	
-#if DEBUGQUANT
-	Serial.print("v in: "); Serial.print(v, 3);
-#endif
-
-	if (cv.seq[cvSeqNo].scale == 0) {		// chromatic
-		v = (float)round(v * 12) / 12;
+void sequencerTimer() {
+	//	timer interrupt - process due master ticks then write any CV and gate values that have fallen due
+	midi.receive();
+	if (editMode == LFO || editMode == NOISE) {
+		return;
 	}
-	else {
-		float v1 = v - int(v);
-		for (int8_t x = 0; x < 12; x++) {
-			if (v1 <= quantiseRange[x].to) {
-				v = int(v) + quantiseRange[x].target;
-				break;
-			}
+	uint32_t now = micros();
+	sequencer.tick(now);
+	SeqEvent e;
+	while (sequencer.getEvent(now, e)) {
+		if (e.type == EVENTCV) {
+			setCV(trackPins[e.track], e.value);
+		}
+		else {
+			digitalWrite(trackPins[e.track], e.value);
 		}
+		midi.output(e);
 	}
+}
 
-#if DEBUGQUANT
-	Serial.print("  v out: "); Serial.print(v, 3); Serial.println("  " + String(dispHandler.pitchFromVolt(v)) + "  " + String(scales[cv.seq[cvSeqNo].scale]));
-#endif
-
-	return v;
+void setCV(uint8_t pin, uint16_t code) {
+	//  DAC buffer takes values of 0 to 4095 relating to 0v to 3.3v - code is the quantised but uncalibrated DAC value from the sequencer
+	if (pin != DACPIN) {		// PWM outputs are not calibrated
+		analogWrite(pin, code);
+		return;
+	}
+	if (calibration.activePoint >= 0) {		// calibration voltage is being output from setup menu
+		return;
+	}
+	analogWrite(DACPIN, calibration.correct(code));
 }
 
+
+
 boolean checkEditing() {
 	// check if recent encoder activity
 	return (editMode != PATTERN && lastEditing > 1 && millis() - lastEditing < 5000);
@@ -807,10 +835,10 @@ boolean checkEditing() {
 void checkEditState() {
 	// check editing mode is valid for selected step type
 	if (editMode != SETUP && editMode != SUBMENU) {
-		if (editStep == -1 && (editMode == STEPV || editMode == STEPR || editMode == STUTTER || !checkEditing())) {
+		if (editStep == -1 && (editMode == STEPV || editMode == STEPR || editMode == STUTTER || editMode == STEPNUDGE || !checkEditing())) {
 			editMode = PATTERN;
 		}
-		if (editStep > -1 && !(editMode == STEPV || editMode == STEPR || editMode == STUTTER)) {
+		if (editStep > -1 && !(editMode == STEPV || editMode == STEPR || editMode == STUTTER || editMode == STEPNUDGE)) {
 			editMode = STEPV;
 		}
 	}
@@ -829,75 +857,17 @@ void normalMode() {
 }
 
 
-float getRandLimit(CvStep s, rndType getUpper) {
-	if (getUpper == UPPER) {
-		return s.volts + ((double)s.rand_amt / 2);
-	}
-	else {
-		return s.volts - ((double)s.rand_amt / 2);
-	}
+int16_t getRandLimit(uint8_t seqNo, uint8_t step, rndType getUpper) {
+	//	returns the DAC code at the upper or lower limit of a step's random range - each random level adds or subtracts half a volt
+	int16_t range = GetNibble(cv.seq[seqNo].randAmt, step) * (DACVOLT / 2);
+	return cv.seq[seqNo].volts[step] + (getUpper == UPPER ? range : -range);
 }
 
 void makeQuantiseArray() {
-	//	makes an array of each scale note voltage with the upper limit of CV that will be quantised to that note
-#if DEBUGQUANT
-	if (millis() < 1000) delay(500);
-#endif
-
-	/*
-	0.000	C		0.000	C		0.167	D		0.083	C#
-	0.083	C#		0.167	D		0.333	E		0.167	D
-	0.167	D		0.333	E		0.500	F#		0.333	E
-	0.250	D#		0.417	F		0.583	G		0.500	F#
-	0.333	E		0.583	G		0.750	A		0.583	G
-	0.417	F		0.750	A		0.917	B		0.750	A
-	0.500	F#		0.917	B		1.083	C#		0.917	B
-	0.583	G		1.000	C		1.167	D		1.167	C#
-	0.667	G#
-	0.750	A
-	0.833	A#
-	0.917	B
-	1.000	C
-	*/
-
-	// no need to generate quantise table if not in pitched mode, chromatic scale or still using previous scale
-	if (cv.seq[cvSeqNo].mode != PITCH || cv.seq[cvSeqNo].scale == 0 || (cv.seq[cvSeqNo].root == oldRoot && cv.seq[cvSeqNo].scale == oldScale)) {
-		return;
-	}
-
-	uint8_t lookupPos = 0;
-	uint8_t s = 0;
-	float targCurr, targPrev, toPrev = 0;
-	for (uint8_t n = 0; n < 28; n++) {
-		if (scaleNotes[cv.seq[cvSeqNo].scale][n % 12] == 1) {
-
-			targCurr = 0.083333 * (n + cv.seq[cvSeqNo].root);
-			if (lookupPos > 0) {
-				// get upper range of previous scale note by averaging difference
-				toPrev = targPrev + ((targCurr - targPrev) / 2);
-			}
-#if DEBUGQUANT
-			Serial.println(String(n) + " toPrev: " + String(toPrev) + "  targCurr: " + String(targCurr) + " targPrev: " + String(targPrev));
-#endif
-			// once we have got beyond the first octave rewrite sequence so that it is ordered but starting from 0 volts
-			if (toPrev > 1 && s < 12) {
-				quantiseRange[s].target = constrain(targPrev - (float)1, 0, 5);
-				quantiseRange[s].to = toPrev - (float)1;
-				s += 1;
-			}
-			targPrev = targCurr;
-			lookupPos += 1;
+	//	builds the quantiser lookup tables for each pitched pattern - tables are only rebuilt if root, scale or tuning have changed so pattern changes need no quantiser work
+	for (uint8_t p = 0; p < 8; p++) {
+		if (cv.seq[p].mode == PITCH) {
+			quantiser.makeTable(p, cv.seq[p].root, cv.seq[p].scale, cv.seq[p].tuning);
 		}
 	}
-
-	oldRoot = cv.seq[cvSeqNo].root;
-	oldScale = cv.seq[cvSeqNo].scale;
-
-#if DEBUGQUANT
-	Serial.println("Quantise scale: " + pitches[cv.seq[cvSeqNo].root] + " " + scales[cv.seq[cvSeqNo].scale]);
-	for (uint8_t n = 0; n < 12; n++) {
-		Serial.println(String(n) + "  target: " + String(quantiseRange[n].target, 3) + "  " + pitches[round(quantiseRange[n].target * 12) % 12] + "  to: " + String(quantiseRange[n].to, 3));
-	}
-#endif
-
-}
\ No newline at end of file
+}
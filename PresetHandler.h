@@ -0,0 +1,244 @@
+#pragma once
+// Preset banks - each bank holds all 8 CV and 8 gate patterns as pattern records, each delta coded against the previous pattern of the same type then run length encoded
+// A recalled bank is unpacked into shadow patterns and their quantiser tables are built in loop(); the whole bank is then swapped in at once,
+// straight away if the first track is not playing, otherwise when the first track next wraps round
+#include "Settings.h"
+#include "StorageHandler.h"
+#include "RecordFormat.h"
+#include "QuantiseHandler.h"
+
+extern CvPatterns cv;
+extern GatePatterns gate;
+extern StorageHandler storage;
+extern QuantiseHandler quantiser;
+extern uint32_t dirtyRecords;
+extern void setDirty(uint8_t record);
+
+class PresetHandler {
+public:
+	boolean store(uint8_t bank);				// compress the working patterns into a bank and flag it for saving - false if too large or the last bank stored is not yet saved
+	boolean recall(uint8_t bank);				// unpack a bank into the shadow patterns and arm the swap - false if the bank is empty or damaged - call from loop()
+	uint8_t packChunk(uint8_t chunk, uint8_t *buf);	// storage record of bank chunk (record id - RECBANK) - returns the record length
+	boolean loadChunk(uint8_t chunk, const uint8_t *data, uint8_t len);	// replace a bank chunk, sent in order from the first chunk of the bank - false if the last bank stored is not yet saved
+	boolean armed() { return swapArmed; }		// a recalled bank is waiting to be swapped in
+	void swap();								// copy every shadow pattern into the working patterns and switch to their quantiser tables - call with interrupts off
+	uint16_t takeSwapped();						// patterns swapped in since last called (bits 0 - 7 CV patterns, 8 - 15 gate patterns) - loop() flags them for saving
+
+private:
+	static const uint16_t streamSize = BANKCHUNKS * StorageHandler::maxPayload;
+	uint16_t compress(uint8_t *out);
+	boolean expand(const uint8_t *in, uint16_t len);
+	uint16_t checksum(const uint8_t *data, uint16_t len);
+
+	// stream layout: length (2 bytes), checksum (2 bytes) then for each pattern the record length followed by the coded record
+	uint8_t stream[streamSize];				// last bank stored - kept until its chunks have been saved
+	uint16_t streamLen;
+	int8_t streamBank = -1;
+	CvSequence cvShadow[8];
+	GateSequence gateShadow[8];
+	volatile boolean swapArmed;				// shadow patterns and quantiser tables are ready to swap in
+	volatile uint16_t swappedMask;
+};
+
+boolean PresetHandler::store(uint8_t bank) {
+	if (streamBank >= 0 && (dirtyRecords & (((1UL << BANKCHUNKS) - 1) << (RECBANK + streamBank * BANKCHUNKS)))) {
+		return 0;
+	}
+
+	//	the stream is only used for saving once complete
+	streamBank = -1;
+	streamLen = compress(stream);
+	if (streamLen == 0) {
+		return 0;
+	}
+	streamBank = bank;
+	for (uint8_t c = 0; c < BANKCHUNKS; c++) {
+		setDirty(RECBANK + bank * BANKCHUNKS + c);
+	}
+	return 1;
+}
+
+boolean PresetHandler::recall(uint8_t bank) {
+	//	cancel a swap still waiting from an earlier recall before the shadow patterns and spare quantiser tables are overwritten
+	noInterrupts();
+	swapArmed = 0;
+	interrupts();
+
+	uint8_t in[streamSize];
+	uint16_t len = 0;
+	if (bank == streamBank) {
+		memcpy(in, stream, streamLen);
+		len = streamLen;
+	}
+	else {
+		for (uint8_t c = 0; c < BANKCHUNKS; c++) {
+			len += storage.read(RECBANK + bank * BANKCHUNKS + c, in + len);
+		}
+	}
+	if (!expand(in, len)) {
+		return 0;
+	}
+
+	for (uint8_t p = 0; p < 8; p++) {
+		if (cvShadow[p].mode == PITCH) {
+			quantiser.makeSpare(p, cvShadow[p].root, cvShadow[p].scale, cvShadow[p].tuning);
+		}
+	}
+	swapArmed = 1;
+	return 1;
+}
+
+uint8_t PresetHandler::packChunk(uint8_t chunk, uint8_t *buf) {
+	//	chunks of banks other than the one just stored are left as they are; chunks beyond the end of the stream are removed
+	if (chunk / BANKCHUNKS != streamBank) {
+		return storage.read(RECBANK + chunk, buf);
+	}
+	uint16_t from = (chunk % BANKCHUNKS) * StorageHandler::maxPayload;
+	if (from >= streamLen) {
+		return 0;
+	}
+	uint8_t len = streamLen - from < StorageHandler::maxPayload ? streamLen - from : StorageHandler::maxPayload;
+	memcpy(buf, stream + from, len);
+	return len;
+}
+
+boolean PresetHandler::loadChunk(uint8_t chunk, const uint8_t *data, uint8_t len) {
+	//	the first chunk of a bank starts a new stream and flags all the bank's chunks so any not sent are removed
+	uint8_t bank = chunk / BANKCHUNKS;
+	uint16_t from = (chunk % BANKCHUNKS) * StorageHandler::maxPayload;
+	if (from == 0) {
+		if (streamBank >= 0 && (dirtyRecords & (((1UL << BANKCHUNKS) - 1) << (RECBANK + streamBank * BANKCHUNKS)))) {
+			return 0;
+		}
+		streamBank = bank;
+		for (uint8_t c = 0; c < BANKCHUNKS; c++) {
+			setDirty(RECBANK + bank * BANKCHUNKS + c);
+		}
+	}
+	else if (bank != streamBank || from > streamLen) {
+		return 0;
+	}
+	memcpy(stream + from, data, len);
+	streamLen = from + len;
+	setDirty(RECBANK + chunk);		// saved again if a save packed the chunk before it arrived
+	return 1;
+}
+
+void PresetHandler::swap() {
+	//	CV patterns not in pitch mode switch to a spare table that was not rebuilt - each table records what it was built for so loop() rebuilds it if needed
+	for (uint8_t p = 0; p < 8; p++) {
+		cv.seq[p] = cvShadow[p];
+		gate.seq[p] = gateShadow[p];
+		quantiser.swapSpare(p);
+	}
+	swapArmed = 0;
+	swappedMask = 0xFFFF;
+}
+
+uint16_t PresetHandler::takeSwapped() {
+	noInterrupts();
+	uint16_t swapped = swappedMask;
+	swappedMask = 0;
+	interrupts();
+	return swapped;
+}
+
+uint16_t PresetHandler::compress(uint8_t *out) {
+	//	patterns in a bank are often variations of each other so each record is XORed with the previous one of the same type, leaving mostly zeros to run length encode
+	uint8_t prev[2][StorageHandler::maxPayload];
+	uint8_t rec[StorageHandler::maxPayload];
+	memset(prev, 0, sizeof(prev));
+	uint16_t n = 4;
+	for (uint8_t i = 0; i < 16; i++) {
+		uint8_t type = i / 8;
+		uint8_t len = type == SEQCV ? packCvPattern(cv.seq[i % 8], rec) : packGatePattern(gate.seq[i % 8], rec);
+		if (n >= streamSize) {
+			return 0;
+		}
+		out[n++] = len;
+		for (uint8_t b = 0; b < len; b++) {
+			rec[b] ^= prev[type][b];
+			prev[type][b] ^= rec[b];		// leaves prev holding the record
+		}
+
+		// a zero byte is followed by the number of zero bytes in the run
+		for (uint8_t b = 0; b < len; b++) {
+			if (n + 2 > streamSize) {
+				return 0;
+			}
+			out[n++] = rec[b];
+			if (rec[b] == 0) {
+				uint8_t r = 1;
+				while (b + r < len && rec[b + r] == 0) {
+					r++;
+				}
+				out[n++] = r;
+				b += r - 1;
+			}
+		}
+	}
+
+	uint16_t sum = checksum(out + 4, n - 4);
+	out[0] = n & 0xFF;
+	out[1] = n >> 8;
+	out[2] = sum & 0xFF;
+	out[3] = sum >> 8;
+	return n;
+}
+
+boolean PresetHandler::expand(const uint8_t *in, uint16_t len) {
+	if (len < 4) {
+		return 0;
+	}
+	uint16_t streamEnd = in[0] | (in[1] << 8);
+	if (streamEnd < 4 || streamEnd > len || checksum(in + 4, streamEnd - 4) != (in[2] | (in[3] << 8))) {
+		Serial.println("Bank empty or damaged");
+		return 0;
+	}
+
+	uint8_t prev[2][StorageHandler::maxPayload];
+	uint8_t rec[StorageHandler::maxPayload];
+	memset(prev, 0, sizeof(prev));
+	uint16_t n = 4;
+	for (uint8_t i = 0; i < 16; i++) {
+		uint8_t type = i / 8;
+		if (n >= streamEnd || in[n] > StorageHandler::maxPayload) {
+			return 0;
+		}
+		uint8_t recLen = in[n++];
+		uint8_t b = 0;
+		while (b < recLen && n < streamEnd) {
+			uint8_t v = in[n++];
+			uint8_t r = 1;
+			if (v == 0 && n < streamEnd) {
+				r = in[n++];
+			}
+			while (r > 0 && b < recLen) {
+				prev[type][b] ^= v;
+				rec[b] = prev[type][b];
+				b++;
+				r--;
+			}
+		}
+
+		RecordReader r(rec, b);
+		if (type == SEQCV) {
+			unpackCvPattern(cvShadow[i % 8], r);
+		}
+		else {
+			unpackGatePattern(gateShadow[i % 8], r);
+		}
+	}
+	return 1;
+}
+
+uint16_t PresetHandler::checksum(const uint8_t *data, uint16_t len) {
+	//	Fletcher-16 - catches a bank whose chunks come from different saves after a power cut
+	uint16_t a = 0;
+	uint16_t b = 0;
+	for (uint16_t i = 0; i < len; i++) {
+		a = (a + data[i]) % 255;
+		b = (b + a) % 255;
+	}
+	return (b << 8) | a;
+}
@@ -0,0 +1,155 @@
+#pragma once
+// Pitch quantiser - builds a lookup table for each CV pattern from DAC code to the DAC code of the nearest note in the pattern's root, scale and tuning
+// Each pattern has a spare table so the tables of a recalled preset bank can be built in loop() and swapped in with its patterns
+#include "Settings.h"
+
+extern uint16_t userScales[];
+
+class QuantiseHandler {
+public:
+	static const uint8_t patterns = 8;
+
+	void makeTable(uint8_t p, uint8_t newRoot, uint8_t newScale, uint8_t newTuning);	// rebuild pattern's lookup table if root, scale notes or tuning have changed
+	void makeSpare(uint8_t p, uint8_t newRoot, uint8_t newScale, uint8_t newTuning);	// build pattern's spare table - used once swapSpare() is called
+	void swapSpare(uint8_t p) { slot[p] ^= 1; }						// pattern's spare table becomes the one used - call with interrupts off
+	uint16_t quantise(uint8_t p, uint16_t code);					// returns the DAC code of the nearest scale note
+	uint16_t stepNote(uint8_t p, uint16_t code, boolean up);		// returns the DAC code of the next scale note above or below
+	uint16_t scaleMask(uint8_t s);									// returns the 12 bit note mask of a built in or user scale
+	String noteName(uint8_t p, uint16_t code);						// note name (12 note tunings) or degree and octave of the nearest scale note
+
+private:
+	static const int16_t octaveQuarters = DACVOLT * 4;		// tuning pitches are calculated in quarter DAC codes to keep 12-EDO semitones (68.25 codes) exact
+
+	void build(uint8_t i, uint8_t newRoot, uint8_t newScale, uint8_t newTuning);		// rebuild table i if root, scale notes or tuning have changed
+
+	// scales repeat every octave so only one octave of quantised codes is stored per table (a full 0-5V table for all patterns would not fit in RAM)
+	// values are relative to the start of the octave and may fall in the octave below or above
+	// tables are indexed by pattern * 2 + slot - the pattern's current slot is in use and the other is its spare
+	static const uint8_t tables = patterns * 2;
+	int16_t table[tables][DACVOLT];
+	int16_t notes[tables][maxDegrees];	// DAC code of each scale note in the octave starting at the root
+	uint8_t degrees[tables][maxDegrees];	// tuning degree of each scale note
+	uint8_t noteCount[tables];
+	volatile uint8_t slot[patterns];
+
+	uint8_t root[tables] = { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF };		// root, scale mask and tuning of each table to check if we need to rebuild
+	uint16_t mask[tables];
+	uint8_t tuning[tables];
+};
+
+uint16_t QuantiseHandler::scaleMask(uint8_t s) {
+	return s >= userScaleFirst ? userScales[s - userScaleFirst] : scaleMasks[s];
+}
+
+void QuantiseHandler::makeTable(uint8_t p, uint8_t newRoot, uint8_t newScale, uint8_t newTuning) {
+	build(p * 2 + slot[p], newRoot, newScale, newTuning);
+}
+
+void QuantiseHandler::makeSpare(uint8_t p, uint8_t newRoot, uint8_t newScale, uint8_t newTuning) {
+	build(p * 2 + (slot[p] ^ 1), newRoot, newScale, newTuning);
+}
+
+void QuantiseHandler::build(uint8_t i, uint8_t newRoot, uint8_t newScale, uint8_t newTuning) {
+	uint16_t newMask = scaleMask(newScale);
+	if (newRoot == root[i] && newMask == mask[i] && newTuning == tuning[i]) {
+		return;
+	}
+	root[i] = newRoot;
+	mask[i] = newMask;
+	tuning[i] = newTuning;
+
+	// get the pitch of each note of the scale in the octave starting at the root - scales are only applied to 12 note tunings
+	const Tuning &t = tunings[newTuning];
+	int16_t pitch[maxDegrees];
+	noteCount[i] = 0;
+	for (uint8_t d = 0; d < t.degrees; d++) {
+		if (t.degrees == 12 && ((newMask >> d) & 1) == 0) {
+			continue;
+		}
+		float octaves = t.ratios ? log((float)t.ratios[d * 2] / t.ratios[d * 2 + 1]) / log(2.0) : (float)d / t.degrees;
+		pitch[noteCount[i]] = (newRoot * octaveQuarters / 12) + round(octaves * octaveQuarters);
+		notes[i][noteCount[i]] = (pitch[noteCount[i]] + 2) / 4;
+		degrees[i][noteCount[i]] = d;
+		noteCount[i]++;
+	}
+
+	// step through every note from two octaves below to the octave above; DAC codes up to halfway to the next scale note are quantised to the previous note
+	// a scale note can be nearly two octaves above C (root B, major seventh) so with few notes in the scale the nearest note below the table is two octaves down
+	int32_t code = 0;
+	int32_t prevQuarter = 0;
+	boolean first = 1;
+	for (int8_t o = -2; o <= 1; o++) {
+		for (uint8_t n = 0; n < noteCount[i]; n++) {
+			int32_t quarter = (o * octaveQuarters) + pitch[n];
+			if (!first) {
+				int32_t to = (prevQuarter + quarter) / 2;
+				int16_t prevNote = (prevQuarter + (prevQuarter < 0 ? -2 : 2)) / 4;
+				while (code * 4 <= to && code < DACVOLT) {
+					table[i][code++] = prevNote;
+				}
+			}
+			prevQuarter = quarter;
+			first = 0;
+		}
+	}
+
+	// codes above the last boundary go to the last note - with very few scale notes the octave above ends before the table does
+	int16_t lastNote = (prevQuarter + (prevQuarter < 0 ? -2 : 2)) / 4;
+	while (code < DACVOLT) {
+		table[i][code++] = lastNote;
+	}
+
+#if DEBUGQUANT
+	Serial.println("Quantise table: " + String(i) + " scale: " + pitches[newRoot] + " mask: " + String(newMask, HEX) + " tuning: " + tuningNames[newTuning]);
+	for (uint8_t n = 0; n < noteCount[i]; n++) {
+		Serial.println(String(degrees[i][n]) + "  code: " + String(notes[i][n]));
+	}
+#endif
+}
+
+uint16_t QuantiseHandler::quantise(uint8_t p, uint16_t code) {
+	uint8_t i = p * 2 + slot[p];
+	uint16_t octave = code / DACVOLT;
+	int16_t q = (octave * DACVOLT) + table[i][code - (octave * DACVOLT)];
+	return constrain(q, 0, 4095);
+}
+
+uint16_t QuantiseHandler::stepNote(uint8_t p, uint16_t code, boolean up) {
+	// search the scale notes in the octaves around the current note for the nearest note above or below
+	int16_t q = quantise(p, code);
+	uint8_t i = p * 2 + slot[p];
+	int16_t octave = q / DACVOLT;
+	int16_t next = q;
+	for (int16_t o = octave - 2; o <= octave + 1; o++) {
+		for (uint8_t n = 0; n < noteCount[i]; n++) {
+			int16_t c = (o * DACVOLT) + notes[i][n];
+			if (c < 0 || c > 4095) {
+				continue;
+			}
+			if (up && c > q) {
+				return c;
+			}
+			if (!up && c < q) {
+				next = c;
+			}
+		}
+	}
+	return next;
+}
+
+String QuantiseHandler::noteName(uint8_t p, uint16_t code) {
+	int16_t q = quantise(p, code);
+	uint8_t i = p * 2 + slot[p];
+	int16_t octave = q / DACVOLT;
+	for (int16_t o = octave - 2; o <= octave; o++) {
+		for (uint8_t n = 0; n < noteCount[i]; n++) {
+			if ((o * DACVOLT) + notes[i][n] == q) {
+				if (tunings[tuning[i]].degrees == 12) {
+					return pitches[(root[i] + degrees[i][n]) % 12] + String(o + (root[i] + degrees[i][n]) / 12);
+				}
+				return String(degrees[i][n]) + ":" + String(o);
+			}
+		}
+	}
+	return "";
+}
@@ -0,0 +1,253 @@
+#pragma once
+// Field by field encoding of storage records - saves do not depend on struct layout, padding or bitfield order so they read the same on the Teensy and a host build
+// Records start with a format byte (top bit set) - a record without one is not readable
+#include "Settings.h"
+#include "StorageHandler.h"
+
+#define RECORDFORMAT 2
+
+class RecordWriter {
+public:
+	RecordWriter(uint8_t *buf, uint8_t size);
+	void put(uint8_t v);
+	void put16(uint16_t v);							// little endian
+	void putArray(const uint8_t *data, uint8_t len);	// written as runs of zero bytes if that is shorter - most random amounts and stutters are zero
+	uint8_t length() { return n; }
+	boolean overflow;								// set if the record did not fit in the buffer
+
+private:
+	uint8_t *buf;
+	uint8_t size;
+	uint8_t n;
+};
+
+class RecordReader {
+public:
+	RecordReader(const uint8_t *buf, uint8_t len);
+	uint8_t format;									// format the record was saved in - 0 if it has no format byte
+	uint8_t get();									// next byte - reads as 0 once past the end of the record
+	uint8_t get(uint8_t max);						// next byte - 0 if greater than max
+	uint16_t get16();
+	void getArray(uint8_t *data, uint8_t len);
+	boolean overrun;								// set if the record was shorter than the fields read from it
+
+private:
+	const uint8_t *buf;
+	uint8_t len;
+	uint8_t n;
+};
+
+// CV and gate pattern records - used for the working patterns and preset banks
+uint8_t packCvPattern(const CvSequence &s, uint8_t *buf);		// returns the record length
+uint8_t packGatePattern(const GateSequence &s, uint8_t *buf);
+void unpackCvPattern(CvSequence &s, RecordReader &r);
+void unpackGatePattern(GateSequence &s, RecordReader &r);
+
+RecordWriter::RecordWriter(uint8_t *buf, uint8_t size) : buf(buf), size(size) {
+	n = 0;
+	overflow = 0;
+	put(0x80 | RECORDFORMAT);
+}
+
+void RecordWriter::put(uint8_t v) {
+	if (n < size) {
+		buf[n++] = v;
+	}
+	else {
+		overflow = 1;
+	}
+}
+
+void RecordWriter::put16(uint16_t v) {
+	put(v & 0xFF);
+	put(v >> 8);
+}
+
+void RecordWriter::putArray(const uint8_t *data, uint8_t len) {
+	// a mode byte of 1 is followed by the array with each run of zero bytes written as a zero and the run length; 0 is followed by the array as it is
+	uint8_t runLength = 0;
+	for (uint8_t i = 0; i < len; i++) {
+		if (data[i] == 0) {
+			uint8_t r = 1;
+			while (i + r < len && data[i + r] == 0) {
+				r++;
+			}
+			runLength += 2;
+			i += r - 1;
+		}
+		else {
+			runLength++;
+		}
+	}
+
+	put(runLength < len ? 1 : 0);
+	for (uint8_t i = 0; i < len; i++) {
+		put(data[i]);
+		if (data[i] == 0 && runLength < len) {
+			uint8_t r = 1;
+			while (i + r < len && data[i + r] == 0) {
+				r++;
+			}
+			put(r);
+			i += r - 1;
+		}
+	}
+}
+
+RecordReader::RecordReader(const uint8_t *buf, uint8_t len) : buf(buf), len(len) {
+	n = 0;
+	overrun = 0;
+	format = 0;
+	if (len > 0 && (buf[0] & 0x80)) {
+		format = buf[0] & 0x7F;
+		n = 1;
+	}
+}
+
+uint8_t RecordReader::get() {
+	if (n < len) {
+		return buf[n++];
+	}
+	overrun = 1;
+	return 0;
+}
+
+uint8_t RecordReader::get(uint8_t max) {
+	uint8_t v = get();
+	return v > max ? 0 : v;
+}
+
+uint16_t RecordReader::get16() {
+	uint8_t lo = get();
+	return lo | (get() << 8);
+}
+
+void RecordReader::getArray(uint8_t *data, uint8_t len) {
+	boolean runs = get();
+	for (uint8_t i = 0; i < len; i++) {
+		data[i] = get();
+		if (data[i] == 0 && runs) {
+			uint8_t r = get();
+			while (r > 1 && i + 1 < len) {
+				data[++i] = 0;
+				r--;
+			}
+		}
+	}
+}
+
+uint8_t packCvPattern(const CvSequence &s, uint8_t *buf) {
+	// only the 8 step pages in use are saved - CV values are packed as 12 bit DAC codes, two steps to three bytes
+	uint8_t steps = ((s.steps + 7) / 8) * 8;
+	RecordWriter w(buf, StorageHandler::maxPayload);
+	w.put(s.steps);
+	w.put((s.mode & 1) | (s.swing << 1) | (s.tuning << 4));
+	w.put(s.root | ((s.ratchetCurve & 7) << 4) | (s.ratchetRamp << 7));
+	w.put(s.scale);
+	w.put(s.markov);
+	for (uint8_t i = 0; i < 4; i++) {
+		w.put(s.nudge[i]);
+	}
+	for (uint8_t i = 0; i < steps; i += 2) {
+		w.put(s.volts[i] & 0xFF);
+		w.put(((s.volts[i] >> 8) & 0xF) | ((s.volts[i + 1] & 0xF) << 4));
+		w.put((s.volts[i + 1] >> 4) & 0xFF);
+	}
+	w.putArray(s.randAmt, steps / 2);
+	w.putArray(s.stutter, steps / 2);
+	return w.length();
+}
+
+uint8_t packGatePattern(const GateSequence &s, uint8_t *buf) {
+	uint8_t steps = ((s.steps + 7) / 8) * 8;
+	RecordWriter w(buf, StorageHandler::maxPayload);
+	w.put(s.steps);
+	w.put((s.mode & 1) | (s.swing << 1));
+	w.put((s.ratchetCurve & 0xF) | ((s.ratchetGate & 0xF) << 4));
+	w.put(s.markov);
+	for (uint8_t i = 0; i < 4; i++) {
+		w.put(s.nudge[i]);
+	}
+	for (uint8_t i = 0; i < steps / 8; i++) {
+		w.put(s.on[i]);
+	}
+	w.putArray(s.randAmt, steps / 2);
+	w.putArray(s.stutter, steps / 2);
+	return w.length();
+}
+
+void unpackCvPattern(CvSequence &s, RecordReader &r) {
+	//	steps beyond the saved pages start blank
+	uint8_t steps = r.get();
+	s.steps = constrain(steps, 1, MAXSTEPS);
+	for (uint8_t i = 0; i < MAXSTEPS; i++) {
+		s.volts[i] = VoltsToCode(2.5);
+	}
+	memset(s.randAmt, 0, sizeof(s.randAmt));
+	memset(s.stutter, 0, sizeof(s.stutter));
+	steps = ((s.steps + 7) / 8) * 8;
+	uint8_t b = r.get();
+	s.mode = b & 1;
+	s.swing = (b >> 1) & 7;
+	s.tuning = b >> 4;
+	if (s.swing > swingSize) {
+		s.swing = 0;
+	}
+	if (s.tuning >= tuningSize) {
+		s.tuning = 0;
+	}
+	b = r.get();
+	s.root = (b & 0xF) % 12;
+	s.ratchetCurve = constrain((int8_t)((((b >> 4) & 7) ^ 4) - 4), -RATCHETCURVE, RATCHETCURVE);
+	s.ratchetRamp = b >> 7;
+	s.scale = r.get(scaleSize - 1);
+	s.markov = r.get();
+	for (uint8_t i = 0; i < 4; i++) {
+		s.nudge[i] = r.get();
+	}
+	for (uint8_t i = 0; i < steps; i += 2) {
+		uint8_t lo = r.get();
+		uint8_t mid = r.get();
+		s.volts[i] = lo | ((mid & 0xF) << 8);
+		s.volts[i + 1] = (mid >> 4) | (r.get() << 4);
+	}
+	r.getArray(s.randAmt, steps / 2);
+	r.getArray(s.stutter, steps / 2);
+	for (uint8_t i = 0; i < steps; i++) {
+		if (GetNibble(s.randAmt, i) > 10) {
+			SetNibble(s.randAmt, i, 10);
+		}
+	}
+}
+
+void unpackGatePattern(GateSequence &s, RecordReader &r) {
+	uint8_t steps = r.get();
+	s.steps = constrain(steps, 1, MAXSTEPS);
+	memset(s.on, 0, sizeof(s.on));
+	memset(s.randAmt, 0, sizeof(s.randAmt));
+	memset(s.stutter, 0, sizeof(s.stutter));
+	steps = ((s.steps + 7) / 8) * 8;
+	uint8_t b = r.get();
+	s.mode = b & 1;
+	s.swing = (b >> 1) & 7;
+	if (s.swing > swingSize) {
+		s.swing = 0;
+	}
+	b = r.get();
+	s.ratchetCurve = constrain(SignedNibble(b & 0xF), -RATCHETCURVE, RATCHETCURVE);
+	s.ratchetGate = constrain(SignedNibble(b >> 4), -1, 2);
+	s.markov = r.get();
+	for (uint8_t i = 0; i < 4; i++) {
+		s.nudge[i] = r.get();
+	}
+	for (uint8_t i = 0; i < steps / 8; i++) {
+		s.on[i] = r.get();
+	}
+	r.getArray(s.randAmt, steps / 2);
+	r.getArray(s.stutter, steps / 2);
+	for (uint8_t i = 0; i < steps; i++) {
+		if (GetNibble(s.randAmt, i) > 10) {
+			SetNibble(s.randAmt, i, 10);
+		}
+	}
+}
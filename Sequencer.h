@@ -0,0 +1,694 @@
+#pragma once
+// Sequencer engine - advances the CV and gate tracks from a master tick counter driven by the internal tempo or external clock pulses, emitting output events rather than writing to pins
+// tick() is called from a timer interrupt and onClock() from the clock pin interrupt or MIDI clock; events are stamped with the exact time they are due so swing and nudges fall between master ticks
+// random values are rolled ahead of time by preroll() from loop() so the interrupts only take a pre-rolled value and scale it
+#include "Settings.h"
+#include "QuantiseHandler.h"
+#include "GeneratorHandler.h"
+#include "HistoryHandler.h"
+#include "SongHandler.h"
+#include "PresetHandler.h"
+
+extern CvPatterns cv;
+extern GatePatterns gate;
+extern QuantiseHandler quantiser;
+extern GeneratorHandler generator;
+extern HistoryHandler history;
+extern SongHandler song;
+extern PresetHandler presets;
+extern double getRand();
+extern int16_t getRandLimit(uint8_t seqNo, uint8_t step, rndType getUpper);
+
+enum seqEventType { EVENTCV, EVENTGATE };
+
+struct SeqEvent {
+	uint8_t type;		// seqEventType
+	uint8_t track;		// track the output belongs to - selects the output pin
+	uint16_t value;		// CV: uncalibrated DAC code; Gate: 1 for high, 0 for low
+	uint32_t time;		// time in microseconds the output is due
+};
+
+class Sequencer {
+public:
+	// per track state is held in arrays indexed by track number so all tracks are evaluated in one loop
+	int8_t step[TRACKS] = { -1, -1, -1, -1 };		// current step of each track's pattern
+	uint8_t seqNo[TRACKS];			// pattern number each track is playing
+	uint8_t loopFirst[TRACKS];		// first sequence in loop
+	uint8_t loopLast[TRACKS];		// last sequence in loop
+	uint8_t ratioMul[TRACKS] = { 1, 1, 1, 1 };		// track clock ratio - ratioMul steps are played in the time of ratioDiv base steps
+	uint8_t ratioDiv[TRACKS] = { 1, 1, 1, 1 };
+	uint8_t direction[TRACKS];		// seqDirection
+	uint16_t value[TRACKS];			// CV: DAC code of current step with randomisation applied; Gate: 1 or 0 according to whether gate is high or low after randomisation
+	int16_t transpose[TRACKS];		// DAC codes added to CV outputs by the song entry the track is playing
+	uint8_t swing;					// global swing (swingOpts index) - used by patterns without their own swing
+	boolean pause;					// if true pause sequencers
+	boolean actionStutter;			// Stutter triggered by action button
+	uint8_t actionStutterNo = 8;	// Number of stutter steps when triggered by action button - actionStutterOpts value
+	boolean holdPattern;			// set while editing to stop pattern loops moving on to the next pattern
+	volatile uint16_t droppedEvents;	// output events lost because the queue was full
+
+	void setTempo(float bpm, boolean clockSignal);	// set master tick length from bpm when free running; clockSignal true if following an external clock
+	void setClockRatio(uint8_t mul, uint8_t div);	// multiply or divide the external clock for all tracks (set from the tempo pot)
+	void onClock(uint32_t t, uint8_t ppqn);			// external clock pulse with ppqn pulses per quarter note received at time t in microseconds - called from the clock pin or sequencer timer interrupt
+	void tick(uint32_t now);						// process any master ticks due by time now (microseconds), queueing output events
+	boolean getEvent(uint32_t now, SeqEvent &e);	// returns true and the earliest queued output event if it is due by time now
+	boolean eventDue(uint32_t now, uint32_t window);	// true if a step or queued output event falls within window microseconds of now
+	void restart();									// restart all tracks from the first step
+	void actionRestart(uint32_t t);					// restart from the action button or CV captured at time t - on the subdivision of the step nearest t
+	void actionStutterStart(uint32_t t);			// start an action stutter captured at time t - the first stutter plays on the subdivision nearest t
+	void start();									// restart all tracks and play the first step on the next external clock pulse - MIDI start
+	void togglePause();
+	void setIdle(boolean on);						// set while the LFO or noise modes use the outputs - clock pulses are ignored, queued events dropped and play resumes from now when cleared
+	uint8_t trackSteps(uint8_t t);					// number of steps in the pattern the track is playing
+	uint8_t trackStutter(uint8_t t);				// ratchet count of the track's current step in its pattern
+	boolean patternPlaying(uint8_t type, uint8_t p);	// true if pattern p of seqType type is being played by a running track
+	boolean running(uint8_t t) { return step[t] >= 0 && !pause && !idle; }	// true if the track is playing
+	void makeMarkovTables();						// rebuild the cumulative Markov tables of all patterns - call after loading or editing weights
+	void preroll();									// top up each track's pre-rolled random values - call from loop()
+	int8_t upcomingStep(uint8_t t) { return nextStep[t]; }
+	int16_t upcomingCV(uint8_t t);					// DAC code the track's next step will output after randomisation - -1 if not yet rolled
+
+private:
+	void masterTick();
+	void resetTracks();
+	boolean nearLastSub(uint32_t t);
+	boolean pushEvent(seqEventType type, uint8_t t, uint16_t value, uint32_t time);	// false if the event was not queued - full queues are counted in droppedEvents
+	void advance(uint8_t t);
+	int32_t stepOffset(uint8_t t);
+	uint16_t roll(uint8_t t);
+	uint16_t cvValue(uint8_t p, uint8_t s, uint16_t die);
+	void scheduleRatchets(uint8_t t);
+	uint32_t ratchetMicros(uint8_t t, uint8_t k);
+	void outputCV(uint8_t t, uint32_t time);
+	void outputGate(uint8_t t, uint32_t time);
+
+	uint32_t tickLength = 5208;		// length of master tick in microseconds (120 bpm)
+	uint32_t nextTick;				// time the next master tick is due
+	uint32_t tickTime;				// time of the master tick being processed
+	uint32_t tickCount;				// master ticks processed
+	uint32_t tickLimit;				// when clocked don't run ahead of the tick the next clock pulse is expected on
+	uint32_t lastPulse;				// time of last external clock pulse
+	boolean waitPulse;				// set by start() to hold the first step until the next clock pulse
+	uint32_t startTime;
+	boolean clocked;
+	boolean idle;
+	uint8_t ticksPerPulse = MASTERPPQN / 4;
+	uint8_t clockMul = 1;			// external clock multiplier and divider
+	uint8_t clockDiv = 1;
+
+	// each master tick adds the track's multiplier to its position and a step falls every STEPTICKS x divider - swing and nudges offset a step from this grid
+	uint16_t basePhase;				// phase of the base (1:1) step - used to time stutters triggered by the action button
+	uint8_t actionSub;				// current subdivision of action button stutter
+	uint32_t subTime;				// time of the master tick the current subdivision started on
+	boolean subNow;					// play an action stutter on the next master tick rather than waiting for the next subdivision
+	boolean restartPending;			// restart at the start of the next subdivision
+	uint32_t pos[TRACKS];			// position of each track
+	uint32_t stepPos[TRACKS];		// position the current step fell on
+	uint32_t gridPos[TRACKS];		// position of the next step before swing and nudge are applied
+	uint32_t nextPos[TRACKS];		// position the next step falls on
+	uint16_t stepLength[TRACKS];	// length of the current step - spacing of the grid and stutters
+	int8_t nextStep[TRACKS] = { -1, -1, -1, -1 };	// step and pattern to play next - chosen a step ahead so its nudge is known
+	uint8_t nextSeqNo[TRACKS];
+	int16_t nextTranspose[TRACKS];
+	boolean nextWrap[TRACKS];		// next step moves on to the next pattern in the loop
+	boolean swingStep[TRACKS];		// swing delays every second step
+	uint8_t stutterCount[TRACKS];	// if a step is in stutter mode store the count of the current stutters
+	uint8_t ratchets[TRACKS];		// ratchet count of the current step - fixed when the step starts
+	uint16_t ratchetAt[TRACKS][16];	// position of each ratchet from the start of the step, ending with the step length
+	uint16_t rampFrom[TRACKS];		// CV ramps run from the value of the step's first ratchet
+	boolean pendulumBack[TRACKS];	// pendulum playback is heading back to the first step
+	uint8_t playCount[TRACKS];		// steps played since the pattern last wrapped - random walk and Markov playback wrap after a pattern's worth of steps
+	uint8_t markovTable[2][8][markovJumpSize];	// running total of each pattern's Markov weights so the next step takes one random draw and a short search
+
+	// each output and each step choice takes exactly one 16 bit die so the values due next can be read ahead for display
+	static const uint8_t diceSize = 16;
+	uint16_t dice[TRACKS][diceSize];
+	volatile uint8_t diceWrite[TRACKS];
+	volatile uint8_t diceRead[TRACKS];
+	uint32_t fallbackDie = 1;		// xorshift state for dice rolled in the interrupt when loop() has not kept up - getRand() is not safe to call there
+
+	static const uint8_t eventQueueSize = 32;
+	SeqEvent events[eventQueueSize];	// held in time order
+	uint8_t eventCount = 0;
+};
+
+void Sequencer::setTempo(float bpm, boolean clockSignal) {
+	clocked = clockSignal;		// onClock() has already limited ticks to the pulse detected
+	if (!clocked) {
+		tickLength = 60000000 / (bpm * MASTERPPQN);
+	}
+}
+
+void Sequencer::setClockRatio(uint8_t mul, uint8_t div) {
+	clockMul = mul;
+	clockDiv = div;
+}
+
+void Sequencer::onClock(uint32_t t, uint8_t ppqn) {
+	if (idle) {
+		return;
+	}
+	waitPulse = 0;
+	ticksPerPulse = MASTERPPQN / ppqn;
+	if (lastPulse > 0 && t - lastPulse < 2000000) {
+		tickLength = (t - lastPulse) / ticksPerPulse;
+	}
+	else {
+		tickLimit = tickCount;		// first pulse after the clock started - play from this pulse rather than catching up
+	}
+	lastPulse = t;
+
+	// if the clock is early catch up on any ticks that have not yet been processed, then allow ticks to run up to the next expected pulse
+	tickTime = t;
+	while (!pause && tickCount < tickLimit) {
+		masterTick();
+	}
+	tickLimit = tickCount + ticksPerPulse;
+	nextTick = t;
+}
+
+uint8_t Sequencer::trackSteps(uint8_t t) {
+	return trackTypes[t] == SEQCV ? cv.seq[seqNo[t]].steps : gate.seq[seqNo[t]].steps;
+}
+
+uint8_t Sequencer::trackStutter(uint8_t t) {
+	if (step[t] < 0) {
+		return 0;
+	}
+	return trackTypes[t] == SEQCV ? GetNibble(cv.seq[seqNo[t]].stutter, step[t]) : GetNibble(gate.seq[seqNo[t]].stutter, step[t]);
+}
+
+boolean Sequencer::patternPlaying(uint8_t type, uint8_t p) {
+	for (uint8_t t = 0; t < TRACKS; t++) {
+		if (trackTypes[t] == type && seqNo[t] == p && step[t] >= 0 && !pause) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void Sequencer::tick(uint32_t now) {
+	if (idle) {
+		return;
+	}
+	//	tracks run free if no pulse follows a start within half a second
+	if (waitPulse && now - startTime > 500000) {
+		waitPulse = 0;
+	}
+	while ((int32_t)(now - nextTick) >= 0 && !waitPulse && (!clocked || tickCount < tickLimit)) {
+		tickTime = nextTick;
+		nextTick += tickLength;
+		if (!pause) {
+			masterTick();
+		}
+	}
+	if ((clocked && tickCount >= tickLimit) || waitPulse) {
+		nextTick = now;		// waiting for the next clock pulse
+	}
+}
+
+void Sequencer::masterTick() {
+	tickCount++;
+
+	//	action button stutters divide the base step by the stutter count
+	uint16_t baseLength = STEPTICKS * clockDiv;
+	basePhase += clockMul;
+	if (basePhase >= baseLength) {
+		basePhase %= baseLength;
+	}
+	uint8_t sub = (uint32_t)basePhase * actionStutterNo / baseLength;
+	if (sub != actionSub) {
+		subTime = tickTime;
+		if (restartPending) {
+			resetTracks();
+		}
+	}
+	boolean newActionStutter = actionStutter && (sub != actionSub || subNow);
+	subNow = 0;
+	actionSub = sub;
+
+	for (uint8_t t = 0; t < TRACKS; t++) {
+		uint16_t inc = ratioMul[t] * clockMul;
+		uint32_t from = pos[t];
+		pos[t] += inc;
+
+		//	first step after starting or restarting falls on this tick
+		if (nextStep[t] < 0) {
+			stepLength[t] = STEPTICKS * ratioDiv[t] * clockDiv;
+			gridPos[t] = from;
+			swingStep[t] = 0;
+			advance(t);
+			int32_t offset = stepOffset(t);
+			nextPos[t] = from + (offset > 0 ? offset : 0);
+		}
+
+		//	output every step and stutter falling within this tick, timed by how far through the tick its position lies
+		boolean output = 0;
+		while (1) {
+			uint32_t due = nextPos[t];
+			boolean trackStep = 1;
+			if (stutterCount[t] > 0 && stutterCount[t] < ratchets[t]) {
+				uint32_t ratchetPos = stepPos[t] + ratchetAt[t][stutterCount[t]];
+				if ((int32_t)(ratchetPos - due) < 0) {
+					due = ratchetPos;
+					trackStep = 0;
+				}
+			}
+			if ((int32_t)(due - pos[t]) >= 0) {
+				break;
+			}
+
+			if (trackStep) {
+				if (nextWrap[t] && !holdPattern) {
+					seqNo[t] = nextSeqNo[t];
+					transpose[t] = nextTranspose[t];
+				}
+				if (nextWrap[t] && trackTypes[t] == SEQGATE && generator.pending(seqNo[t])) {
+					generator.apply(seqNo[t]);
+				}
+				if (t == 0 && nextWrap[t] && presets.armed()) {
+					//	a recalled bank is swapped in whole when the first track wraps - interrupts are held off so the clock pin interrupt never sees part of it
+					noInterrupts();
+					presets.swap();
+					makeMarkovTables();
+					interrupts();
+				}
+				step[t] = nextStep[t];
+				if (step[t] >= trackSteps(t)) {
+					step[t] = direction[t] == DIRREVERSE ? trackSteps(t) - 1 : 0;
+				}
+				stepPos[t] = due;
+				stutterCount[t] = 0;
+				scheduleRatchets(t);
+			}
+
+			uint32_t time = tickTime + (uint32_t)((uint64_t)(uint32_t)(due - from) * tickLength / inc);
+			trackTypes[t] == SEQCV ? outputCV(t, time) : outputGate(t, time);
+			output = 1;
+
+			//	schedule the following step on the grid, offset by its swing and nudge but never before the step just played
+			if (trackStep) {
+				stepLength[t] = STEPTICKS * ratioDiv[t] * clockDiv;
+				gridPos[t] += stepLength[t];
+				swingStep[t] = !swingStep[t];
+				advance(t);
+				nextPos[t] = gridPos[t] + stepOffset(t);
+				if ((int32_t)(nextPos[t] - stepPos[t]) <= 0) {
+					nextPos[t] = stepPos[t] + 1;
+				}
+			}
+		}
+
+		if (newActionStutter && !output && step[t] >= 0) {
+			trackTypes[t] == SEQCV ? outputCV(t, tickTime) : outputGate(t, tickTime);
+		}
+	}
+}
+
+void Sequencer::advance(uint8_t t) {
+	//	choose the step after the current one in the track's playback order, moving on to the next pattern in the loop when the pattern wraps round
+	boolean reverse = direction[t] == DIRREVERSE;
+	uint8_t steps = trackSteps(t);
+	int8_t s = step[t];
+	nextWrap[t] = 0;
+	if (s < 0) {
+		pendulumBack[t] = 0;
+		playCount[t] = 0;
+	}
+	else {
+		uint16_t die = roll(t);
+		if (direction[t] == DIRWALK || direction[t] == DIRMARKOV) {
+			die = history.orderDie(trackTypes[t], seqNo[t], playCount[t], die);
+		}
+		switch (direction[t]) {
+		case DIRREVERSE:
+			nextWrap[t] = s == 0;
+			s -= 1;
+			break;
+		case DIRPENDULUM:
+			// bounce between the first and last steps without repeating them - the pattern wraps when it gets back to the first step
+			s += pendulumBack[t] ? -1 : 1;
+			if (s >= steps - 1) {
+				pendulumBack[t] = 1;
+			}
+			if (s <= 0) {
+				nextWrap[t] = pendulumBack[t];
+				pendulumBack[t] = 0;
+			}
+			break;
+		case DIRWALK:
+			s += (die & 0x8000) ? 1 : -1;
+			break;
+		case DIRMARKOV: {
+			uint8_t *table = markovTable[trackTypes[t]][seqNo[t]];
+			uint8_t r = ((die >> 8) * table[markovJumpSize - 1]) >> 8;		// high byte picks the jump, low byte the step to jump to
+			uint8_t j = 0;
+			while (r >= table[j]) {
+				j++;
+			}
+			s = j == 0 ? s + 1 : (j == 1 ? s : (j == 2 ? s - 1 : (int8_t)(((die & 0xFF) * steps) >> 8)));
+			break;
+		}
+		default:
+			s += 1;
+			nextWrap[t] = s >= steps;
+		}
+
+		if (direction[t] == DIRWALK || direction[t] == DIRMARKOV) {
+			s = (s + steps) % steps;
+			nextWrap[t] = ++playCount[t] >= steps;
+			if (nextWrap[t]) {
+				playCount[t] = 0;
+			}
+		}
+	}
+
+	nextSeqNo[t] = seqNo[t];
+	nextTranspose[t] = 0;
+	if (song.playing() && (step[t] < 0 || nextWrap[t])) {
+		//	song mode - the first CV track counts the passes of each entry and every track picks up the entry playing when its own pattern wraps
+		if (t == songTrack && step[t] >= 0) {
+			song.nextPass();
+		}
+		nextSeqNo[t] = song.pattern(trackTypes[t]);
+		nextTranspose[t] = trackTypes[t] == SEQCV ? song.transpose() : 0;
+		nextWrap[t] = 1;
+	}
+	else if (nextWrap[t] && loopLast[t] > loopFirst[t]) {
+		nextSeqNo[t] = seqNo[t] >= loopLast[t] ? loopFirst[t] : seqNo[t] + 1;
+	}
+	if (nextSeqNo[t] != seqNo[t]) {
+		steps = trackTypes[t] == SEQCV ? cv.seq[nextSeqNo[t]].steps : gate.seq[nextSeqNo[t]].steps;
+	}
+	if (s < 0 || s >= steps || nextSeqNo[t] != seqNo[t]) {
+		s = reverse ? steps - 1 : 0;
+	}
+
+	//	each random walk or Markov pass starts where the recorded pass did so a locked pattern repeats
+	if ((direction[t] == DIRWALK || direction[t] == DIRMARKOV) && (step[t] < 0 || nextWrap[t])) {
+		uint8_t start = history.passStart(trackTypes[t], nextSeqNo[t], s);
+		s = start < steps ? start : s;
+	}
+	nextStep[t] = s;
+}
+
+void Sequencer::makeMarkovTables() {
+	for (uint8_t p = 0; p < 8; p++) {
+		for (uint8_t type = SEQCV; type <= SEQGATE; type++) {
+			uint8_t weights = type == SEQCV ? cv.seq[p].markov : gate.seq[p].markov;
+			uint8_t total = 0;
+			for (uint8_t j = 0; j < markovJumpSize; j++) {
+				total += (weights >> (j * 2)) & 3;
+				markovTable[type][p][j] = total;
+			}
+			if (total == 0) {		// no weights set - always move on to the next step
+				for (uint8_t j = 0; j < markovJumpSize; j++) {
+					markovTable[type][p][j] = 1;
+				}
+			}
+		}
+	}
+}
+
+int32_t Sequencer::stepOffset(uint8_t t) {
+	//	swing delays every second step by a share of the pair of steps; nudges move a step position early or late by sixteenths of a step
+	uint8_t patternSwing = trackTypes[t] == SEQCV ? cv.seq[nextSeqNo[t]].swing : gate.seq[nextSeqNo[t]].swing;
+	uint8_t *nudge = trackTypes[t] == SEQCV ? cv.seq[nextSeqNo[t]].nudge : gate.seq[nextSeqNo[t]].nudge;
+	int32_t offset = (int32_t)stepLength[t] * SignedNibble(GetNibble(nudge, nextStep[t] & 7)) / NUDGEDIV;
+	if (swingStep[t]) {
+		offset += (int32_t)stepLength[t] * 2 * (swingOpts[patternSwing > 0 ? patternSwing - 1 : swing] - 50) / 100;
+	}
+	return offset;
+}
+
+uint16_t Sequencer::cvValue(uint8_t p, uint8_t s, uint16_t die) {
+	// calculate possible ranges of randomness to ensure we don't try and set a random value out of permitted range
+	if (GetNibble(cv.seq[p].randAmt, s)) {
+		int16_t randLower = getRandLimit(p, s, LOWER);
+		int16_t randUpper = getRandLimit(p, s, UPPER);
+		return constrain(randLower + (((int32_t)(randUpper - randLower) * die) >> 16), 0, 4095);
+	}
+	return cv.seq[p].volts[s];
+}
+
+void Sequencer::scheduleRatchets(uint8_t t) {
+	//	lay out the step's ratchets once as it starts - a curve of c adds c/RATCHETCURVE of a parabola to the even spacing, keeping the ratchets in order
+	ratchets[t] = trackStutter(t);
+	if (ratchets[t] == 0) {
+		return;
+	}
+	int8_t curve = trackTypes[t] == SEQCV ? cv.seq[seqNo[t]].ratchetCurve : gate.seq[seqNo[t]].ratchetCurve;
+	int32_t n = ratchets[t];
+	int32_t length = stepLength[t];
+	for (uint8_t k = 0; k <= n; k++) {
+		ratchetAt[t][k] = length * k / n + length * curve * k * (n - k) / (RATCHETCURVE * n * n);
+	}
+}
+
+uint32_t Sequencer::ratchetMicros(uint8_t t, uint8_t k) {
+	//	time from ratchet k to the following ratchet (or the end of the step) at the current tempo
+	return (uint32_t)(ratchetAt[t][k + 1] - ratchetAt[t][k]) * tickLength / (ratioMul[t] * clockMul);
+}
+
+int16_t Sequencer::upcomingCV(uint8_t t) {
+	//	the next step takes the die after those used by the current step's remaining ratchets
+	uint8_t ahead = ratchets[t] > stutterCount[t] ? ratchets[t] - stutterCount[t] : 0;
+	uint8_t read = diceRead[t];
+	if (nextStep[t] < 0 || ahead >= (uint8_t)(diceWrite[t] - read + diceSize) % diceSize) {
+		return -1;
+	}
+	return cvValue(nextSeqNo[t], nextStep[t], history.cvDie(nextSeqNo[t], nextStep[t], dice[t][(read + ahead) % diceSize], 0));
+}
+
+void Sequencer::preroll() {
+	for (uint8_t t = 0; t < TRACKS; t++) {
+		uint8_t next = (diceWrite[t] + 1) % diceSize;
+		while (next != diceRead[t]) {
+			dice[t][diceWrite[t]] = getRand() * 65535;
+			__asm__ volatile("" ::: "memory");		// the die must be stored before the interrupt can see the new write index
+			diceWrite[t] = next;
+			next = (next + 1) % diceSize;
+		}
+	}
+}
+
+uint16_t Sequencer::roll(uint8_t t) {
+	//	take the next pre-rolled die - roll one here if loop() has not kept up
+	if (diceRead[t] == diceWrite[t]) {
+		fallbackDie ^= fallbackDie << 13;
+		fallbackDie ^= fallbackDie >> 17;
+		fallbackDie ^= fallbackDie << 5;
+		return fallbackDie >> 16;
+	}
+	uint16_t die = dice[t][diceRead[t]];
+	diceRead[t] = (diceRead[t] + 1) % diceSize;
+	return die;
+}
+
+void Sequencer::outputCV(uint8_t t, uint32_t time) {
+	CvSequence &s = cv.seq[seqNo[t]];
+	if (ratchets[t] > 0 || actionStutter) {
+		if (actionStutter) {
+			stutterCount[t] = actionSub;
+		}
+		stutterCount[t] += 1;
+	}
+
+	//	the first output of each step is recorded in the pattern's random history - a locked pattern replays it for every ratchet of the step
+	uint16_t die = roll(t);
+	if (!actionStutter && GetNibble(s.randAmt, step[t])) {
+		die = history.cvDie(seqNo[t], step[t], die, stutterCount[t] <= 1);
+	}
+	value[t] = cvValue(seqNo[t], step[t], die);
+
+	//	ramped ratchets move evenly from the first ratchet's value towards the next step's programmed voltage - chosen by the time the second ratchet plays
+	if (s.ratchetRamp && ratchets[t] > 0 && !actionStutter) {
+		if (stutterCount[t] <= 1) {
+			rampFrom[t] = value[t];
+		}
+		else {
+			int32_t target = cv.seq[nextSeqNo[t]].volts[nextStep[t]];
+			value[t] = rampFrom[t] + (target - rampFrom[t]) * (stutterCount[t] - 1) / ratchets[t];
+		}
+	}
+
+	uint16_t code = constrain((int16_t)value[t] + transpose[t], 0, 4095);
+	if (s.mode == PITCH) {
+		code = quantiser.quantise(seqNo[t], code);
+	}
+	pushEvent(EVENTCV, t, code, time);
+}
+
+void Sequencer::outputGate(uint8_t t, uint32_t time) {
+	// calculate probability of gate being high or low. Eg randAmt = 9 means there is a 90% chance that the value will be randomised
+	GateSequence &s = gate.seq[seqNo[t]];
+	boolean on = GetBit(s.on, step[t]);
+	uint8_t randAmt = GetNibble(s.randAmt, step[t]);
+	uint16_t die = roll(t);
+	uint32_t length = s.mode == TRIGGER ? 10000 : 0;		// time until the gate goes low - 0 holds it until the next step
+	if (ratchets[t] > 0 || actionStutter) {
+		if (actionStutter) {
+			// action stutters alternate the gate on each subdivision of the step
+			stutterCount[t] = actionSub + 1;
+			value[t] = ((stutterCount[t] + (on ? 0 : 1)) % 2 > 0);
+		}
+		else {
+			// each ratchet is a separate hit lasting a share of the time to the next ratchet - an off step skips its first hit
+			uint8_t k = stutterCount[t]++;
+			value[t] = on || k > 0;
+			uint32_t hit = ratchetMicros(t, k) * ratchetGates[s.ratchetGate + 1] / 100;
+			length = length > 0 && length < hit ? length : hit;
+		}
+
+		// if randomising mute 'on' stutters according to probablility setting - ratchet mutes are recorded in the pattern's random history
+		boolean mute = randAmt && ((die & 0xFF) * 14 >> 8) < randAmt;
+		if (randAmt && !actionStutter) {
+			mute = history.ratchetMute(seqNo[t], step[t], stutterCount[t] - 1, mute, die);
+		}
+		if (value[t] && mute) {
+			value[t] = 0;
+		}
+	}
+	else {
+		if (randAmt) {
+			uint8_t rndXTen = ((die & 0xFF) * 10) >> 8;		// low byte sets the chance of randomising, top bit the coin toss
+			boolean flip = history.gateFlip(seqNo[t], step[t], randAmt > rndXTen && !(die & 0x8000), die);
+			value[t] = flip ? !on : on;
+		}
+		else {
+			value[t] = on;
+		}
+	}
+	pushEvent(EVENTGATE, t, value[t], time);
+
+	//	end trigger pulses after 10ms and ratchets after their gate length
+	if (length > 0 && value[t]) {
+		pushEvent(EVENTGATE, t, 0, time + length);
+	}
+}
+
+boolean Sequencer::pushEvent(seqEventType type, uint8_t t, uint16_t value, uint32_t time) {
+	//	insert the event after any events due at the same time or earlier - nothing is queued while the LFO or noise modes use the outputs
+	if (idle) {
+		return 0;
+	}
+	if (eventCount == eventQueueSize) {
+		droppedEvents++;
+		return 0;
+	}
+	uint8_t i = eventCount++;
+	while (i > 0 && (int32_t)(events[i - 1].time - time) > 0) {
+		events[i] = events[i - 1];
+		i--;
+	}
+	events[i].type = type;
+	events[i].track = t;
+	events[i].value = value;
+	events[i].time = time;
+	return 1;
+}
+
+boolean Sequencer::getEvent(uint32_t now, SeqEvent &e) {
+	if (eventCount == 0 || (int32_t)(now - events[0].time) < 0) {
+		return 0;
+	}
+	e = events[0];
+	eventCount--;
+	for (uint8_t i = 0; i < eventCount; i++) {
+		events[i] = events[i + 1];
+	}
+	return 1;
+}
+
+boolean Sequencer::eventDue(uint32_t now, uint32_t window) {
+	//	called from loop() so positions and the event queue are read with interrupts off
+	noInterrupts();
+	boolean due = eventCount > 0 && (int32_t)(events[0].time - now) < (int32_t)window;
+	for (uint8_t t = 0; t < TRACKS && !pause; t++) {
+		if (nextStep[t] >= 0) {
+			uint32_t ticks = (nextPos[t] - pos[t]) / (ratioMul[t] * clockMul);
+			if ((int32_t)(nextTick - now) + (int32_t)(ticks * tickLength) < (int32_t)window) {
+				due = 1;
+			}
+		}
+	}
+	interrupts();
+	return due;
+}
+
+void Sequencer::restart() {
+	//	tracks start again from the first step on the next master tick
+	noInterrupts();
+	resetTracks();
+	interrupts();
+}
+
+void Sequencer::resetTracks() {
+	for (uint8_t t = 0; t < TRACKS; t++) {
+		step[t] = -1;
+		nextStep[t] = -1;
+	}
+	song.restart();
+	restartPending = 0;
+}
+
+boolean Sequencer::nearLastSub(uint32_t t) {
+	//	true if time t is nearer the start of the current action subdivision than the next, or the next has already started - call with interrupts off
+	uint32_t subLength = (uint32_t)STEPTICKS * clockDiv * tickLength / (actionStutterNo * clockMul);
+	int32_t since = t - subTime;
+	return since < 0 || (uint32_t)since < subLength / 2;
+}
+
+void Sequencer::actionRestart(uint32_t t) {
+	//	a press just after a subdivision started is a late press and restarts straight away; one just before the next waits for it
+	noInterrupts();
+	if (pause || nearLastSub(t)) {
+		resetTracks();
+	}
+	else {
+		restartPending = 1;
+	}
+	interrupts();
+}
+
+void Sequencer::actionStutterStart(uint32_t t) {
+	noInterrupts();
+	actionStutter = 1;
+	subNow = nearLastSub(t);
+	interrupts();
+}
+
+void Sequencer::start() {
+	restart();
+	noInterrupts();
+	tickLimit = tickCount;		// no catching up on ticks left over from the last pulse
+	waitPulse = 1;
+	startTime = micros();
+	pause = 0;
+	interrupts();
+}
+
+void Sequencer::setIdle(boolean on) {
+	if (on == idle) {
+		return;
+	}
+	noInterrupts();
+	idle = on;
+	eventCount = 0;				// events queued before the LFO or noise started are stale
+	nextTick = micros();		// carry on from now rather than catching up on the ticks missed while idle
+	interrupts();
+}
+
+void Sequencer::togglePause() {
+	// ensure gates are off when pausing
+	noInterrupts();
+	pause = !pause;
+	if (pause) {
+		for (uint8_t t = 0; t < TRACKS; t++) {
+			if (trackTypes[t] == SEQGATE) {
+				pushEvent(EVENTGATE, t, 0, micros());
+			}
+		}
+	}
+	interrupts();
+}
@@ -0,0 +1,266 @@
+#pragma once
+// USB serial protocol - binary frames to dump and load settings, patterns, the song and preset banks, stream steps and telemetry and edit steps remotely
+// Frame: sync byte, payload length, frame type, payload, CRC-16/CCITT of length, type and payload (low byte first)
+// Bytes are parsed as they arrive and frames are only sent when the USB buffer has room so loop() is never held up; debug text between frames is skipped by the host
+#include "Settings.h"
+#include "StorageHandler.h"
+#include "RecordFormat.h"
+#include "SetupFunctions.h"
+
+extern CvPatterns cv;
+extern GatePatterns gate;
+extern SetupMenu setupMenu;
+extern Sequencer sequencer;
+extern ClockHandler clock;
+extern SongHandler song;
+extern uint32_t dirtyRecords;
+extern void setDirty(uint8_t record), makeQuantiseArray();
+
+// frame types - frames marked host are sent by the host, the others by the module
+enum frameType {
+	FRAMEPING = 1,		// host: no payload - replied to with FRAMEINFO
+	FRAMEINFO,			// record format, number of records, first bank record, banks, chunks per bank
+	FRAMEGET,			// host: record id - replied to with FRAMERECORD
+	FRAMERECORD,		// record id followed by the record as saved in the journaled store
+	FRAMEPUT,			// host: record id followed by a record - loaded into the working settings, patterns or song, or into a bank
+	FRAMEEDIT,			// host: seqType, pattern, step, field (0 volts or gate on, 1 random amount, 2 stutter), value (2 bytes)
+	FRAMESAVE,			// host: no payload - save edited records
+	FRAMESTREAM,		// host: bit 0 streams step frames, bit 1 telemetry frames
+	FRAMESTEP,			// track, pattern, step, output value (2 bytes) - sent as each track moves on a step
+	FRAMETELEMETRY,		// bpm x 10 (2 bytes), flags (bit 0 clocked, 1 paused, 2 song mode, 3 saving, 4 sequencer events dropped since the last telemetry), song position, edited records not yet saved
+	FRAMEACK,			// frame type accepted, first payload byte of the frame
+	FRAMENAK			// frame type refused, first payload byte of the frame
+};
+
+class SerialHandler {
+public:
+	void receive();						// parse bytes waiting on the USB serial port and act on complete frames - call every pass of loop()
+	void stream(float bpm);				// send step and telemetry frames if the host has asked for them
+
+private:
+	static const uint8_t sync = 0x7E;
+	static const uint8_t maxFrame = StorageHandler::maxPayload + 1;		// a record and its id
+	static const uint8_t maxBytesPerPass = 64;
+	static const uint16_t telemetryInterval = 250;		// milliseconds
+
+	void handle();
+	void reply(uint8_t type, const uint8_t *data, uint8_t len);
+	boolean send(uint8_t type, const uint8_t *data, uint8_t len);	// false if there is no room in the USB buffer
+	boolean edit(const uint8_t *data);
+
+	enum { WAITSYNC, WAITLENGTH, WAITTYPE, WAITPAYLOAD, WAITCRC, WAITCRCHIGH } state = WAITSYNC;
+	uint8_t rx[maxFrame];
+	uint8_t rxLen;
+	uint8_t rxType;
+	uint8_t rxPos;
+	uint16_t rxCrc;
+
+	uint8_t tx[maxFrame + 5];			// reply waiting for room in the USB buffer - no more frames are parsed until it is sent
+	uint8_t txLen;
+
+	uint8_t streaming;
+	int8_t lastStep[TRACKS];
+	uint32_t lastTelemetry;
+	uint16_t lastDropped;				// sequencer dropped event count at the last telemetry sent
+};
+
+void SerialHandler::receive() {
+	if (txLen > 0) {
+		if (Serial.availableForWrite() < txLen) {
+			return;
+		}
+		Serial.write(tx, txLen);
+		txLen = 0;
+	}
+
+	uint8_t n = 0;
+	while (Serial.available() > 0 && n++ < maxBytesPerPass && txLen == 0) {
+		uint8_t b = Serial.read();
+		switch (state) {
+		case WAITSYNC:
+			if (b == sync) {
+				state = WAITLENGTH;
+			}
+			break;
+		case WAITLENGTH:
+			rxLen = b;
+			rxCrc = StorageHandler::crc(0xFFFF, b);
+			state = b > maxFrame ? WAITSYNC : WAITTYPE;
+			break;
+		case WAITTYPE:
+			rxType = b;
+			rxCrc = StorageHandler::crc(rxCrc, b);
+			rxPos = 0;
+			state = rxLen > 0 ? WAITPAYLOAD : WAITCRC;
+			break;
+		case WAITPAYLOAD:
+			rx[rxPos++] = b;
+			rxCrc = StorageHandler::crc(rxCrc, b);
+			if (rxPos == rxLen) {
+				state = WAITCRC;
+			}
+			break;
+		case WAITCRC:
+			state = b == (rxCrc & 0xFF) ? WAITCRCHIGH : WAITSYNC;
+			break;
+		case WAITCRCHIGH:
+			state = WAITSYNC;
+			if (b == (rxCrc >> 8)) {
+				handle();
+			}
+			break;
+		}
+	}
+}
+
+void SerialHandler::handle() {
+	uint8_t arg = rxLen > 0 ? rx[0] : 0;
+	uint8_t buf[maxFrame];
+	boolean ok = 0;
+
+	switch (rxType) {
+	case FRAMEPING:
+		buf[0] = RECORDFORMAT;
+		buf[1] = StorageHandler::maxRecords;
+		buf[2] = RECBANK;
+		buf[3] = BANKS;
+		buf[4] = BANKCHUNKS;
+		reply(FRAMEINFO, buf, 5);
+		return;
+
+	case FRAMEGET:
+		if (rxLen == 1 && arg < StorageHandler::maxRecords) {
+			buf[0] = arg;
+			reply(FRAMERECORD, buf, setupMenu.packRecord(arg, buf + 1) + 1);
+			return;
+		}
+		break;
+
+	case FRAMEPUT:
+		if (rxLen >= 1 && arg < StorageHandler::maxRecords && setupMenu.loadRecord(arg, rx + 1, rxLen - 1)) {
+			if (arg < RECBANK) {
+				makeQuantiseArray();
+				sequencer.makeMarkovTables();
+				setDirty(arg);
+			}
+			ok = 1;
+		}
+		break;
+
+	case FRAMEEDIT:
+		ok = rxLen == 6 && edit(rx);
+		break;
+
+	case FRAMESAVE:
+		setupMenu.saveSettings();
+		ok = 1;
+		break;
+
+	case FRAMESTREAM:
+		streaming = arg;
+		for (uint8_t t = 0; t < TRACKS; t++) {
+			lastStep[t] = -1;
+		}
+		ok = 1;
+		break;
+	}
+
+	buf[0] = rxType;
+	buf[1] = arg;
+	reply(ok ? FRAMEACK : FRAMENAK, buf, 2);
+}
+
+boolean SerialHandler::edit(const uint8_t *data) {
+	uint8_t type = data[0];
+	uint8_t p = data[1];
+	uint8_t s = data[2];
+	uint8_t field = data[3];
+	uint16_t value = data[4] | (data[5] << 8);
+	if (type > SEQGATE || p > 7 || s >= MAXSTEPS || field > 2) {
+		return 0;
+	}
+	uint8_t *randAmt = type == SEQCV ? cv.seq[p].randAmt : gate.seq[p].randAmt;
+	uint8_t *stutter = type == SEQCV ? cv.seq[p].stutter : gate.seq[p].stutter;
+
+	if (field == 0 && type == SEQCV && value < 4096) {
+		cv.seq[p].volts[s] = value;
+	}
+	else if (field == 0 && type == SEQGATE && value < 2) {
+		SetBit(gate.seq[p].on, s, value);
+	}
+	else if (field == 1 && value <= 10) {
+		SetNibble(randAmt, s, value);
+	}
+	else if (field == 2 && value < 16) {
+		SetNibble(stutter, s, value);
+	}
+	else {
+		return 0;
+	}
+	setDirty((type == SEQCV ? RECCVPATTERN : RECGATEPATTERN) + p);
+	return 1;
+}
+
+void SerialHandler::reply(uint8_t type, const uint8_t *data, uint8_t len) {
+	//	held until there is room if the USB buffer is full
+	if (!send(type, data, len)) {
+		uint16_t c = StorageHandler::crc(StorageHandler::crc(0xFFFF, len), type);
+		tx[0] = sync;
+		tx[1] = len;
+		tx[2] = type;
+		for (uint8_t i = 0; i < len; i++) {
+			tx[3 + i] = data[i];
+			c = StorageHandler::crc(c, data[i]);
+		}
+		tx[3 + len] = c & 0xFF;
+		tx[4 + len] = c >> 8;
+		txLen = len + 5;
+	}
+}
+
+boolean SerialHandler::send(uint8_t type, const uint8_t *data, uint8_t len) {
+	if (Serial.availableForWrite() < len + 5) {
+		return 0;
+	}
+	uint16_t c = StorageHandler::crc(StorageHandler::crc(0xFFFF, len), type);
+	uint8_t header[] = { sync, len, type };
+	Serial.write(header, 3);
+	for (uint8_t i = 0; i < len; i++) {
+		c = StorageHandler::crc(c, data[i]);
+	}
+	Serial.write(data, len);
+	uint8_t crc[] = { (uint8_t)(c & 0xFF), (uint8_t)(c >> 8) };
+	Serial.write(crc, 2);
+	return 1;
+}
+
+void SerialHandler::stream(float bpm) {
+	//	live frames are dropped rather than queued if the host is not keeping up
+	if (txLen > 0) {
+		return;
+	}
+	if (streaming & 1) {
+		for (uint8_t t = 0; t < TRACKS; t++) {
+			if (sequencer.step[t] != lastStep[t]) {
+				uint8_t buf[] = { t, sequencer.seqNo[t], (uint8_t)sequencer.step[t], (uint8_t)(sequencer.value[t] & 0xFF), (uint8_t)(sequencer.value[t] >> 8) };
+				if (send(FRAMESTEP, buf, sizeof(buf))) {
+					lastStep[t] = sequencer.step[t];
+				}
+			}
+		}
+	}
+	if ((streaming & 2) && millis() - lastTelemetry > telemetryInterval) {
+		uint16_t tenths = bpm * 10;
+		uint8_t dirty = 0;
+		for (uint8_t r = 0; r < StorageHandler::maxRecords; r++) {
+			dirty += (dirtyRecords >> r) & 1;
+		}
+		uint16_t dropped = sequencer.droppedEvents;
+		uint8_t flags = clock.hasSignal() | (sequencer.pause << 1) | (song.active << 2) | (setupMenu.saving() << 3) | ((dropped != lastDropped) << 4);
+		uint8_t buf[] = { (uint8_t)(tenths & 0xFF), (uint8_t)(tenths >> 8), flags, song.position(), dirty };
+		if (send(FRAMETELEMETRY, buf, sizeof(buf))) {
+			lastTelemetry = millis();
+			lastDropped = dropped;
+		}
+	}
+}
@@ -14,6 +14,7 @@
 #define DEBUGQUANT 0
 #define DEBUGBTNS 0
 #define DEBUGFRAME 0
+#define DEBUGMIDI 0
 
 #define LED 13
 #define CLOCKPIN 14		// incoming voltage clock
@@ -22,6 +23,9 @@
 #define ENCDATAPIN 17	// encoder pin 3
 #define GATEOUT 18		// Gate sequence out
 #define DACPIN 40		// CV sequence out
+#define GATEOUT2 2		// Gate out for second gate track (expansion header)
+#define PWMCV 3			// PWM out for second CV track - needs an RC filter and output buffer (expansion header)
+#define DACVOLT 819		// DAC codes per volt - 4095 codes across the 0-5V output range
 
 #define OLED_CS    9
 #define OLED_DC    8
@@ -29,60 +33,163 @@
 #define OLED_MOSI  6		// D1 on OLED
 #define OLED_CLK   5		// D0 on OLED
 
-// edit modes: STEPV voltage; STEPR random level; STUTTER stutter count; PATTERN pattern number; STEPS in pattern; SEQOPTS - randomise settings; SETUP - system menu; LFO/NOISE - lfo or white noise mode
-enum editType { STEPV, STEPR, STUTTER, PATTERN, SEQMODE, STEPS, LOOPFIRST, LOOPLAST, SEQOPT, SEQROOT, SEQSCALE, SETUP, SUBMENU, LFO, NOISE };
+// edit modes: STEPV voltage; STEPR random level; STUTTER stutter count; STEPNUDGE step timing; PATTERN pattern number; STEPS in pattern; SEQOPTS - randomise settings; SCALEEDIT - user scale notes; SEQTUNING - pitch mode tuning; SEQRATIO/SEQDIR/SEQMARKOV/SEQSWING - track clock ratio, playback order, Markov weights and pattern swing; SEQLOCK/SEQMUTATE - random history lock and mutate chance; SEQRATCHET/SEQRATCHETLEN - ratchet shape and gate length (gate) or ramp (CV); GENFILL/GENROTATE - gate generator hits and rotation; SETUP - system menu; LFO/NOISE - lfo or white noise mode
+enum editType { STEPV, STEPR, STUTTER, STEPNUDGE, PATTERN, SEQMODE, STEPS, LOOPFIRST, LOOPLAST, SEQOPT, SEQROOT, SEQSCALE, SCALEEDIT, SEQTUNING, SEQRATIO, SEQDIR, SEQMARKOV, SEQSWING, SEQLOCK, SEQMUTATE, SEQRATCHET, SEQRATCHETLEN, GENFILL, GENROTATE, SETUP, SUBMENU, LFO, NOISE };
 
 // action mode - what happens when the action button is pressed
-enum actionOpts { ACTSTUTTER, ACTRESTART, ACTPAUSE };
+enum actionOpts { ACTSTUTTER, ACTRESTART, ACTPAUSE, ACTLOCK };
 
 enum seqType { SEQCV, SEQGATE };
 enum cvMode { CV, PITCH};
 enum gateMode { GATE, TRIGGER };
 enum rndType { UPPER, LOWER };
+enum seqDirection { DIRFORWARD, DIRREVERSE, DIRPENDULUM, DIRWALK, DIRMARKOV };
+
+// tracks each play a CV or gate pattern with their own clock ratio and direction - the first CV and gate tracks drive the DAC and main gate output
+#define TRACKS 4
+seqType const trackTypes[TRACKS] = { SEQCV, SEQGATE, SEQGATE, SEQCV };
+String const trackNames[TRACKS] = { "CV", "Gt", "G2", "C2" };
+uint8_t const trackPins[TRACKS] = { DACPIN, GATEOUT, GATEOUT2, PWMCV };
+uint8_t const songTrack = 0;		// track whose pattern wraps count the passes of each song entry - the first CV track
+String const directions[] = { "Fwd", "Rev", "Pend", "Walk", "Markov" };
+uint8_t const directionSize = 5;
+// Markov playback picks each next step by weighted chance of moving on, repeating, going back a step or jumping to any step
+String const markovJumps[] = { "Next", "Rept", "Back", "Jump" };
+uint8_t const markovJumpSize = 4;
+
+// sequencer timing runs from a master tick counter - each step is an eighth note at the track's clock ratio of 1:1
+#define MASTERPPQN 96			// master ticks per quarter note
+#define STEPTICKS (MASTERPPQN / 2)
+uint8_t const ppqnOpts[] = { 1, 2, 4, 24, 48 };		// external clock pulses per quarter note
+String const ppqnNames[] = { "1", "2", "4", "24", "48" };
+uint8_t const ppqnSize = 5;
+enum clockSource { SOURCEPIN, SOURCEMIDI };
+
+// USB-MIDI clock in and note/CC out need the Teensy USB Type set to Serial + MIDI - each track sends on its own channel (track number + 1)
+#if defined(USB_MIDI_SERIAL) || defined(USB_MIDI)
+#define USBMIDI 1
+#else
+#define USBMIDI 0
+#endif
+#define MIDIPPQN 24			// MIDI clock pulses per quarter note
+#define MIDICVNOTE 36		// note sent by pitch mode CV tracks at 0V
+#define MIDICVCC 16			// controller sent by CV mode CV tracks
+#define MIDIGATENOTE 60		// note sent by gate tracks
+
+// track clock ratios as steps played (multiplier) per base steps (divider) - eg 5:4 plays 5 steps in the time of 4
+uint8_t const trackRatios[][2] = { { 1, 8 }, { 1, 6 }, { 1, 4 }, { 1, 3 }, { 1, 2 }, { 2, 3 }, { 3, 4 }, { 4, 5 }, { 1, 1 }, { 5, 4 }, { 4, 3 }, { 3, 2 }, { 2, 1 }, { 3, 1 }, { 4, 1 }, { 6, 1 }, { 8, 1 } };
+uint8_t const trackRatioSize = 17;
+
+// swing delays every second step - amounts are the share of each pair of steps taken by the first step (50% is straight, 67% a triplet feel)
+uint8_t const swingOpts[] = { 50, 54, 58, 62, 67, 71, 75 };
+String const swingNames[] = { "50%", "54%", "58%", "62%", "67%", "71%", "75%" };
+uint8_t const swingSize = 7;
+#define NUDGEDIV 16		// steps are nudged early or late in sixteenths of a step
+
+// ratchets split a step into its stutter count of hits - the curve bends their spacing so hits speed up (positive) or slow down (negative) across the step
+#define RATCHETCURVE 3
+String const ratchetShapes[] = { "Slow3", "Slow2", "Slow1", "Even", "Fast1", "Fast2", "Fast3" };		// indexed by curve + RATCHETCURVE
+uint8_t const ratchetGates[] = { 25, 50, 75, 90 };		// gate ratchet length as a percentage of the ratchet spacing - indexed by ratchetGate + 1 so 0 is 50%
+String const ratchetGateNames[] = { "25%", "50%", "75%", "90%" };
+uint8_t const actionStutterOpts[] = { 2, 3, 4, 5, 6, 8, 12, 16 };		// subdivisions of a step when stuttering from the action button or CV
+String const actionStutterNames[] = { "2", "3", "4", "5", "6", "8", "12", "16" };
+uint8_t const actionStutterSize = 8;
 
 static String const OffOnOpts[] = { "Off", "On" };
 String const pitches[] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
-String const scales[] = { "Chromatic", "Major", "Pentatonic", "Harmonic minor", "Melodic minor" };
-static boolean scaleNotes[5][12] = { { 1,1,1,1,1,1,1,1,1,1,1,1 },{ 1,0,1,0,1,1,0,1,0,1,0,1 },{ 1,0,0,1,0,1,0,1,0,0,1,0 },{ 1,0,1,1,0,1,0,1,1,0,0,1 },{ 1,0,1,1,0,1,0,1,0,1,0,1 } };
-uint8_t const scaleSize = 5;
-String const scalesShort[] = { "", "", "p", "h", "m" };
-String const actions[] = { "Stutter", "Restart", "Pause" };
+String const scales[] = { "Chromatic", "Major", "Pentatonic", "Harmonic minor", "Melodic minor", "Natural minor", "Dorian", "Phrygian", "Lydian", "Mixolydian", "Maj pentatonic", "Blues", "Whole tone", "User 1", "User 2" };
+// scale notes stored as 12 bit masks - bit 0 is the root, bit 11 the major seventh
+uint16_t const scaleMasks[] = { 0xFFF, 0xAB5, 0x4A9, 0x9AD, 0xAAD, 0x5AD, 0x6AD, 0x5AB, 0xAD5, 0x6B5, 0x295, 0x4E9, 0x555 };
+uint8_t const scaleSize = 15;
+uint8_t const userScaleFirst = 13;		// scales from this position are user defined and editable
+uint8_t const userScaleCount = 2;
+String const scalesShort[] = { "", "", "p", "h", "m", "n", "d", "y", "l", "x", "P", "b", "w", "1", "2" };
+String const actions[] = { "Stutter", "Restart", "Pause", "Lock" };
+uint8_t const actionSize = 4;
+
+// tunings for pitch mode: Scala style ratio lists (numerator, denominator pairs for each degree) or equal divisions of the octave if no ratios given
+struct Tuning {
+	uint8_t degrees;			// number of notes per octave
+	const uint16_t *ratios;
+};
+uint16_t const justRatios[] = { 1,1, 16,15, 9,8, 6,5, 5,4, 4,3, 45,32, 3,2, 8,5, 5,3, 9,5, 15,8 };
+uint16_t const pythagoreanRatios[] = { 1,1, 256,243, 9,8, 32,27, 81,64, 4,3, 729,512, 3,2, 128,81, 27,16, 16,9, 243,128 };
+Tuning const tunings[] = { { 12, nullptr }, { 12, justRatios }, { 12, pythagoreanRatios }, { 19, nullptr }, { 24, nullptr }, { 31, nullptr } };
+String const tuningNames[] = { "12-EDO", "Just", "Pythagorean", "19-EDO", "24-EDO", "31-EDO" };
+String const tuningsShort[] = { "", "", "", "19", "24", "31" };
+uint8_t const tuningSize = 6;
+uint8_t const maxDegrees = 31;		// largest number of notes per octave in any tuning
+
 
 enum seqInitType { INITNONE, INITRAND, INITVALS, INITBLANK, INITHIGH, INITMEDIUM, INITLOW };
 String const initCVSeq[] = { "None", "All", "Vals", "Blank", "High", "Med", "Low" };
 uint8_t const initCVSeqSize = 7;
-String const initGateSeq[] = { "None", "All", "Vals", "Blank" };
-uint8_t const initGateSeqSize = 4;
+String const initGateSeq[] = { "None", "All", "Vals", "Blank", "Euclid", "Dense", "Grid" };
+uint8_t const initGateSeqSize = 7;
+uint8_t const initGenFirst = 4;		// gate options from this position fill the pattern from the generator (genType order)
+enum genType { GENEUCLID, GENDENSITY, GENGRID };
 
 
 // adds or subtracts one from a number, looping back to zero if > max or to max if < 0
 #define AddNLoop(x,add,max) ((x)==(max)&&(add)?0:((x)==0&&!(add)?(max):((add)?(x)+1:(x)-1)))
 
+// converts a voltage in the 0-5V output range to an uncalibrated DAC code
+#define VoltsToCode(v) ((uint16_t)constrain((int32_t)round((v) * DACVOLT), 0, 4095))
+
 
 // define structures to store sequence data
-struct CvStep {
-	float volts;
-	uint8_t rand_amt : 4; // from 0 to 10
-	uint16_t stutter : 5;
-};
-struct GateStep {
-	uint16_t on : 1;
-	uint8_t rand_amt : 4; // from 0 to 10
-	uint16_t stutter : 5;
-};
+// steps are held as structure of arrays so whole pattern operations are simple loops and long patterns fit in RAM and EEPROM
+#define MAXSTEPS 64		// maximum number of steps in a pattern - the display pages through 8 steps at a time
+
+// read and write 4 bit values packed two per byte (even steps in the low nibble) and single bits packed eight per byte
+#define GetNibble(arr, i) (((arr)[(i) >> 1] >> (((i) & 1) * 4)) & 0xF)
+#define SetNibble(arr, i, v) ((arr)[(i) >> 1] = ((arr)[(i) >> 1] & ~(0xF << (((i) & 1) * 4))) | (((v) & 0xF) << (((i) & 1) * 4)))
+#define GetBit(arr, i) (((arr)[(i) >> 3] >> ((i) & 7)) & 1)
+#define SetBit(arr, i, v) ((arr)[(i) >> 3] = ((arr)[(i) >> 3] & ~(1 << ((i) & 7))) | (((v) ? 1 : 0) << ((i) & 7)))
+#define SignedNibble(n) ((int8_t)(((n) ^ 8) - 8))		// nibble read as a signed value from -8 to 7
+
 struct CvSequence {
-	uint8_t steps : 4;		//  Number of steps in sequence
+	uint8_t steps;			//  Number of steps in sequence (1 - MAXSTEPS)
 	uint8_t mode : 4;		//	CV or pitch mode
-	uint8_t root : 6;
-	uint8_t scale : 6;
-	struct CvStep Steps[8];
+	uint8_t tuning : 4;		//	tuning used in pitch mode
+	uint8_t root;
+	uint8_t scale;
+	uint8_t swing;			//	0 to follow the global swing, otherwise swingOpts index + 1
+	uint8_t nudge[4];		//	timing of each step position in the 8 step page (repeating on later pages) - packed signed nibbles in sixteenths of a step
+	uint8_t markov;			//	Markov playback weight (0 - 3) of each markovJumps entry - packed 2 bits each
+	int8_t ratchetCurve;	//	ratchet spacing from -RATCHETCURVE (slowing down) to RATCHETCURVE (speeding up) - 0 is even
+	uint8_t ratchetRamp;	//	if set ratchets ramp from the step's value towards the next step's voltage
+	uint16_t volts[MAXSTEPS];				// step voltage as an uncalibrated DAC code (0 - 4095)
+	uint8_t randAmt[MAXSTEPS / 2];			// random amount from 0 to 10 - packed nibbles
+	uint8_t stutter[MAXSTEPS / 2];			// ratchet count (0 - 15) - packed nibbles
 };
 struct GateSequence {
-	uint8_t steps : 4;		//  Number of steps in sequence
-	uint8_t mode : 4;		//	Gate or trigger mode
-	struct GateStep Steps[8];
+	uint8_t steps;			//  Number of steps in sequence (1 - MAXSTEPS)
+	uint8_t mode;			//	Gate or trigger mode
+	uint8_t swing;			//	0 to follow the global swing, otherwise swingOpts index + 1
+	uint8_t nudge[4];		//	timing of each step position in the 8 step page (repeating on later pages) - packed signed nibbles in sixteenths of a step
+	uint8_t markov;			//	Markov playback weight (0 - 3) of each markovJumps entry - packed 2 bits each
+	int8_t ratchetCurve;	//	ratchet spacing from -RATCHETCURVE (slowing down) to RATCHETCURVE (speeding up) - 0 is even
+	int8_t ratchetGate;		//	ratchet gate length - ratchetGates index - 1
+	uint8_t on[MAXSTEPS / 8];				// gate on/off - packed bits
+	uint8_t randAmt[MAXSTEPS / 2];			// random amount from 0 to 10 - packed nibbles
+	uint8_t stutter[MAXSTEPS / 2];			// ratchet count (0 - 15) - packed nibbles
+};
+
+// song mode plays a list of entries, each a CV and gate pattern played for a number of passes of the first CV track with a transposition in semitones
+#define SONGSIZE 16		// maximum entries in a song
+struct SongEntry {
+	uint8_t cvPattern;
+	uint8_t gatePattern;
+	uint8_t repeats;		//	passes of the first CV track's pattern before moving on (1 - 16) - 0 removes the entry
+	int8_t transpose;		//	semitones added to the CV tracks (-12 to 12)
 };
 
+// preset banks each hold a compressed copy of all CV and gate patterns, stored in the journaled EEPROM store as up to BANKCHUNKS records
+#define BANKS 4
+#define BANKCHUNKS 3
+String const bankNames[] = { "Bank A", "Bank B", "Bank C", "Bank D" };
+
 struct CvPatterns {
 	struct CvSequence seq[8];
 };
@@ -95,10 +202,7 @@ struct GatePatterns {
 struct Btn {
 	int name;
 	int pin;
-	boolean pressed;
-	boolean released;
-	boolean longClick;
-	uint32_t lastPressed;
+	boolean longClick;		// set by a long press so the release that follows is not a click
 };
 enum btnName { STEPUP, STEPDN, ENCODER, CHANNEL, ACTIONBTN, ENCUP, ENCDN, ACTIONCV };
 
@@ -109,12 +213,6 @@ struct MenuItem {
 	String val = "";
 };
 
-struct QuantiseRange {
-	float to;		// the upper range of voltage included in this quantise step
-	float target;	// the voltage to shift the CV to if in this step
-};
-
-
 
 #endif
 
@@ -1,19 +1,57 @@
 #pragma once
 #include <array>
 #include <EEPROM.h>
+#include "CalibrationHandler.h"
+#include "ClockHandler.h"
+#include "Sequencer.h"
+#include "StorageHandler.h"
+#include "RecordFormat.h"
 
 extern CvPatterns cv;
 extern GatePatterns gate;
 extern editType editMode;
-extern uint8_t cvLoopFirst, cvLoopLast, gateLoopFirst, gateLoopLast, submenuSize, submenuVal;
-extern boolean autoSave, saveRequired, revEnc;
-extern void checkEditState(), normalMode(), initCvSequence(int seqNum, seqInitType initType, uint16_t numSteps), initGateSequence(int seqNum, seqInitType initType, uint16_t numSteps), makeQuantiseArray();
+extern uint8_t submenuSize, submenuVal;
+extern boolean autoSave, revEnc;
+extern uint32_t dirtyRecords;
+extern void setDirty(uint8_t record), checkEditState(), normalMode(), initCvSequence(int seqNum, seqInitType initType, uint16_t numSteps), initGateSequence(int seqNum, seqInitType initType, uint16_t numSteps), makeQuantiseArray();
 extern actionOpts actionCVType, actionBtnType;
-extern int8_t cvOffset;
+extern CalibrationHandler calibration;
+extern Sequencer sequencer;
+extern SongHandler song;
+extern StorageHandler storage;
+extern PresetHandler presets;
+extern ClockHandler clock;
+extern uint16_t userScales[];
 const String *submenuArray;		// Stores a pointer to the array used to select submenu choices
 
-std::array<MenuItem, 10> menu{ { { 0, "LFO Mode", 1 },{ 1, "Noise Mode" },{ 2, "Action CV", 0, actions[0] },{ 3, "Action Btn", 0, actions[0] },
-{ 4, "Autosave", 0, OffOnOpts[0] },{ 5, "Init All" },{ 6, "Save Settings" },{ 7, "Load Settings" },{ 8, "CV Calibration", 0, "0" },{ 9, "Reverse Encoder", 0, OffOnOpts[0] } } };
+// pattern layout saved by settings version 1 when the cv and gate structs were copied directly to EEPROM - used to upgrade old saves
+struct LegacyCvStep {
+	float volts;
+	uint8_t rand_amt : 4;
+	uint16_t stutter : 5;
+};
+struct LegacyGateStep {
+	uint16_t on : 1;
+	uint8_t rand_amt : 4;
+	uint16_t stutter : 5;
+};
+struct LegacyCvSequence {
+	uint8_t steps : 4;
+	uint8_t mode : 4;
+	uint8_t root : 6;
+	uint8_t scale : 6;
+	struct LegacyCvStep Steps[8];
+};
+struct LegacyGateSequence {
+	uint8_t steps : 4;
+	uint8_t mode : 4;
+	struct LegacyGateStep Steps[8];
+};
+
+std::array<MenuItem, 17> menu{ { { 0, "LFO Mode", 1 },{ 1, "Noise Mode" },{ 2, "Action CV", 0, actions[0] },{ 3, "Action Btn", 0, actions[0] },
+{ 4, "Autosave", 0, OffOnOpts[0] },{ 5, "Init All" },{ 6, "Save Settings" },{ 7, "Load Settings" },{ 8, "CV Calibration" },{ 9, "Reverse Encoder", 0, OffOnOpts[0] },
+{ 10, "Clock PPQN", 0, ppqnNames[2] },{ 11, "Swing", 0, swingNames[0] },{ 12, "Action Stutter", 0, actionStutterNames[5] },
+{ 13, "Song Mode", 0, OffOnOpts[0] },{ 14, "Edit Song" },{ 15, "Store Bank" },{ 16, "Recall Bank" } } };
 
 class SetupMenu {
 public:
@@ -24,13 +62,32 @@ public:
 	String menuCurrent();		// name of currently selected menu item
 	String menuVal(uint8_t n);
 	void setVal(String name, String val);
-	void saveSettings();
+	void saveSettings();		// start saving records flagged in dirtyRecords in the background - written a few bytes at a time by saveStep()
+	void saveStep();			// continue a save in progress - call every pass of loop()
+	boolean saving() { return saveRecord >= 0; }
 	boolean loadSettings();		// returns true if settings found in EEPROM
+	uint8_t packRecord(uint8_t id, uint8_t *buf);	// pack settings, a pattern, the song or a bank chunk as a storage record - returns the record length
+	boolean loadRecord(uint8_t id, const uint8_t *buf, uint8_t len);	// load a storage record into the working settings, patterns or song or a bank - false if not readable
 	boolean numberEdit;			// true if submenu function is editing number
 private:
 	void romWrite(uint16_t pos, uint8_t val);
 	uint8_t romRead(uint16_t pos);
-
+	void nextSaveRecord();							// pack the next record to save or finish the save
+	uint8_t packSettings(uint8_t *buf);
+	uint8_t packSong(uint8_t *buf);
+	boolean loadRecords();							// load settings saved in the journaled store - returns false if no settings record found
+	void unpackSettings(RecordReader &r);
+	void unpackSong(RecordReader &r);
+	void loadLegacyPatterns();						// upgrade patterns saved as 8 step structs by version 1
+
+	// background save - each record is packed when its turn comes so edits made during a save are saved by it or flag the next save
+	static const uint8_t saveBytesPerStep = 4;		// most EEPROM bytes changed in one pass of loop()
+	static const uint32_t saveYield = 2000;			// no save work within this many microseconds of a step
+	int8_t saveRecord = -1;							// record being saved - -1 if not saving
+	uint8_t saveBuf[StorageHandler::maxPayload];
+	uint8_t saveLen;
+	boolean saveAgain;								// a save was requested while saving
+	boolean saveFull;
 };
 
 String SetupMenu::menuName(uint8_t n) {
@@ -73,13 +130,24 @@ void SetupMenu::menuPicker(int action) {
 
 	if (editMode == SUBMENU) {
 		if (menuCurrent() == "CV Calibration") {
-			if (action == ENCUP) {
-				cvOffset += 1;
+			// guided calibration: encoder adjusts the current point until the output measures exactly 0V, 1V ... 5V; click to move to next point
+			if (action == ENCUP || action == ENCDN) {
+				calibration.adjustPoint(action == ENCUP ? 1 : -1);
 			}
-			else if (action == ENCDN) {
-				cvOffset -= 1;
+			else if (action == ENCODER) {
+				calibration.nextPoint();
 			}
-			setVal("CV Calibration", cvOffset);
+			setVal("CV Calibration", calibration.activePoint >= 0 ? calibration.pointDescription() : "");
+		}
+		else if (menuCurrent() == "Edit Song") {
+			// encoder picks an entry then alters each of its fields in turn; click moves on to the next field
+			if (action == ENCUP || action == ENCDN) {
+				song.editValue(action == ENCUP);
+			}
+			else if (action == ENCODER) {
+				song.nextField();
+			}
+			setVal("Edit Song", song.editEntry >= 0 ? song.editDescription() : "");
 		}
 		else if (action == ENCUP && submenuVal < submenuSize - 1) {
 			submenuVal += 1;
@@ -87,7 +155,7 @@ void SetupMenu::menuPicker(int action) {
 		else if (action == ENCDN && submenuVal > 0) {
 			submenuVal -= 1;
 		}
-		if (action == ENCODER) {
+		if (action == ENCODER && calibration.activePoint == -1 && song.editEntry == -1) {
 			editMode = SETUP;
 			numberEdit = 0;
 			
@@ -102,8 +170,27 @@ void SetupMenu::menuPicker(int action) {
 						actionBtnType = (actionOpts)submenuVal;
 						setVal(menu[m].name, actions[actionBtnType]);
 					}
+					if (menu[m].name == "Clock PPQN") {
+						clock.ppqn = ppqnOpts[submenuVal];
+						setVal(menu[m].name, ppqnNames[submenuVal]);
+					}
+					if (menu[m].name == "Swing") {
+						sequencer.swing = submenuVal;
+						setVal(menu[m].name, swingNames[submenuVal]);
+					}
+					if (menu[m].name == "Action Stutter") {
+						sequencer.actionStutterNo = actionStutterOpts[submenuVal];
+						setVal(menu[m].name, actionStutterNames[submenuVal]);
+					}
+					if (menu[m].name == "Store Bank") {
+						setVal(menu[m].name, presets.store(submenuVal) ? bankNames[submenuVal] : "Failed");
+					}
+					if (menu[m].name == "Recall Bank") {
+						setVal(menu[m].name, presets.recall(submenuVal) ? bankNames[submenuVal] : "Empty");
+					}
 				}
 			}
+			setDirty(menuCurrent() == "Edit Song" ? RECSONG : RECSETTINGS);
 			saveSettings();
 		}
 	}
@@ -129,26 +216,33 @@ void SetupMenu::menuPicker(int action) {
 		if (action == ENCODER) {
 			for (uint8_t m = 0; m < menu.size(); m++) {
 				if (menu[m].selected) {
+#if DEBUGBTNS
 					Serial.println(menu[m].name);
+#endif
 					if (menu[m].name == "< Back") {
 						normalMode();
 					}
 					else if (menu[m].name == "Save Settings") {
+						dirtyRecords = (1UL << StorageHandler::maxRecords) - 1;		// unchanged records are only compared
 						saveSettings();
 						normalMode();
 					}
 					else if (menu[m].name == "Load Settings") {
 						loadSettings();
+						makeQuantiseArray();
+						sequencer.makeMarkovTables();
 						normalMode();
 					}
 					else if (menu[m].name == "LFO Mode") {
 						editMode = LFO;
+						setDirty(RECSETTINGS);
 						if (autoSave) {
 							saveSettings();
 						}
 					}
 					else if (menu[m].name == "Noise Mode") {
 						editMode = NOISE;
+						setDirty(RECSETTINGS);
 						if (autoSave) {
 							saveSettings();
 						}
@@ -163,28 +257,77 @@ void SetupMenu::menuPicker(int action) {
 					}
 					else if (menu[m].name == "Autosave") {
 						autoSave = !autoSave;
+						setDirty(RECSETTINGS);
 						saveSettings();
 						menu[m].val = OffOnOpts[autoSave];
 					}
 					else if (menu[m].name == "Action CV") {
 						submenuArray = actions;
-						submenuSize = 3;				// can't find way of checking this dynamically
+						submenuSize = actionSize;
 						submenuVal = actionCVType;
 						editMode = SUBMENU;
 					}
 					else if (menu[m].name == "Action Btn") {
 						submenuArray = actions;
-						submenuSize = 3;				// can't find way of checking this dynamically
+						submenuSize = actionSize;
 						submenuVal = actionBtnType;
 						editMode = SUBMENU;
 					}
+					else if (menu[m].name == "Clock PPQN") {
+						submenuArray = ppqnNames;
+						submenuSize = ppqnSize;
+						submenuVal = 0;
+						for (uint8_t p = 0; p < ppqnSize; p++) {
+							if (ppqnOpts[p] == clock.ppqn) {
+								submenuVal = p;
+							}
+						}
+						editMode = SUBMENU;
+					}
+					else if (menu[m].name == "Swing") {
+						submenuArray = swingNames;
+						submenuSize = swingSize;
+						submenuVal = sequencer.swing;
+						editMode = SUBMENU;
+					}
+					else if (menu[m].name == "Action Stutter") {
+						submenuArray = actionStutterNames;
+						submenuSize = actionStutterSize;
+						submenuVal = 0;
+						for (uint8_t a = 0; a < actionStutterSize; a++) {
+							if (actionStutterOpts[a] == sequencer.actionStutterNo) {
+								submenuVal = a;
+							}
+						}
+						editMode = SUBMENU;
+					}
 					else if (menu[m].name == "CV Calibration") {
 						editMode = SUBMENU;
 						numberEdit = 1;
-						setVal("CV Calibration", cvOffset);
+						calibration.startCalibration();
+						setVal("CV Calibration", calibration.pointDescription());
+					}
+					else if (menu[m].name == "Song Mode") {
+						song.active = !song.active;
+						setDirty(RECSONG);
+						sequencer.restart();
+						menu[m].val = OffOnOpts[song.active];
+					}
+					else if (menu[m].name == "Edit Song") {
+						editMode = SUBMENU;
+						numberEdit = 1;
+						song.startEdit();
+						setVal("Edit Song", song.editDescription());
+					}
+					else if (menu[m].name == "Store Bank" || menu[m].name == "Recall Bank") {
+						submenuArray = bankNames;
+						submenuSize = BANKS;
+						submenuVal = 0;
+						editMode = SUBMENU;
 					}
 					else if (menu[m].name == "Reverse Encoder") {
 						revEnc = !revEnc;
+						setDirty(RECSETTINGS);
 						saveSettings();
 						menu[m].val = OffOnOpts[revEnc];
 					}
@@ -199,7 +342,6 @@ void SetupMenu::menuPicker(int action) {
 void SetupMenu::romWrite(uint16_t pos, uint8_t val) {
 	if (EEPROM.read(pos) != val) {
 		EEPROM.write(pos, val);
-		Serial.print("write: "); Serial.print(pos); Serial.print(": "); Serial.println(val);
 	}
 }
 
@@ -208,64 +350,143 @@ uint8_t SetupMenu::romRead(uint16_t pos) {
 }
 
 void SetupMenu::saveSettings() {
-	saveRequired = 0;
+	if (saving()) {
+		saveAgain = 1;
+		return;
+	}
 
-	// write variables and cv/gate structs to EEPROM (2048 bytes in Teensy 3.2)
-	// to provide some future proofing store variables from 0, cv struct (est 544 bytes) from 500, gate struct (est 144 bytes from 1500)
+	// settings, each pattern and the song are saved as records in the journaled store - see StorageHandler
+	// only records flagged as edited are packed, and those that have not changed since the last save are not written again
 
-	//	Basic header to check if settings are saved - ASCII values of 'PD' followed by version
-	romWrite(0, 80);
-	romWrite(1, 68);
-	romWrite(2, 1);
+	//	Basic header to check if settings are saved - ASCII values of 'PD' followed by version - version 11 and later hold the journaled store
+	if (romRead(0) != 80 || romRead(1) != 68 || romRead(2) != 11) {
+		romWrite(0, 80);
+		romWrite(1, 68);
+		romWrite(2, 11);
+		storage.format();		// settings in the older fixed layout have already been loaded so are rewritten as records
+		dirtyRecords = (1UL << StorageHandler::maxRecords) - 1;
+	}
 
-	romWrite(3, cvLoopFirst);		// first sequence in loop
-	romWrite(4, cvLoopLast);		// last sequence in loop
-	romWrite(5, gateLoopFirst);		// first sequence in loop
-	romWrite(6, gateLoopLast);		// last sequence in loop
+	saveRecord = -1;
+	saveAgain = 0;
+	saveFull = 0;
+	setVal("Save Settings", "Saving");
+	nextSaveRecord();
+}
 
-	romWrite(7, (editMode == LFO));		// LFO Mode
-	romWrite(8, (editMode == NOISE));	// Noise Mode
+void SetupMenu::saveStep() {
+	if (!saving() || sequencer.eventDue(micros(), saveYield)) {
+		return;
+	}
 
-	romWrite(9, autoSave);
-	//romWrite(10, pitchMode);
-	//romWrite(11, quantRoot);
-	//romWrite(12, quantScale);
+	storeResult result = storage.write(saveRecord, saveBuf, saveLen, saveBytesPerStep);
+	if (result == STOREBUSY) {
+		return;
+	}
+	if (result == STOREFULL) {
+		saveFull = 1;
+		setDirty(saveRecord);		// try again on the next save
+	}
+	nextSaveRecord();
+}
 
-	romWrite(13, actionCVType);
-	romWrite(14, actionBtnType);
+void SetupMenu::nextSaveRecord() {
+	do {
+		saveRecord++;
+	} while (saveRecord < StorageHandler::maxRecords && !((dirtyRecords >> saveRecord) & 1));
 
-	//romWrite(15, triggerMode);
+	if (saveRecord < StorageHandler::maxRecords) {
+		saveLen = packRecord(saveRecord, saveBuf);
+		dirtyRecords &= ~(1UL << saveRecord);
 
-	romWrite(16, cvOffset);
-	romWrite(17, revEnc);
+		//	gate patterns still to be regenerated are saved again once the generator has changed them
+		if (saveRecord >= RECGATEPATTERN && saveRecord < RECSONG && generator.pending(saveRecord - RECGATEPATTERN)) {
+			setDirty(saveRecord);
+		}
+		return;
+	}
 
-	// Serialise cv struct
-	char cvToByte[sizeof(cv)];
-	memcpy(cvToByte, &cv, sizeof(cv));
-	for (uint16_t b = 0; b < sizeof(cv); b++) {		// Write cv array from position 500
-		romWrite(b + 500, cvToByte[b]);
+	saveRecord = -1;
+	setVal("Save Settings", saveFull ? "Full" : "");
+	if (saveFull) {
+		Serial.println("Save error - storage full");
+	}
+	if (saveAgain) {
+		saveSettings();
 	}
+}
 
-	// Serialise gate struct
-	char gateToByte[sizeof(gate)];
-	memcpy(gateToByte, &gate, sizeof(gate));
-	for (uint16_t b = 0; b < sizeof(gate); b++) {		// Write gate array from position 1500
-		romWrite(b + 1500, gateToByte[b]);
+uint8_t SetupMenu::packRecord(uint8_t id, uint8_t *buf) {
+	if (id == RECSETTINGS) {
+		return packSettings(buf);
+	}
+	if (id < RECGATEPATTERN) {
+		return packCvPattern(cv.seq[id - RECCVPATTERN], buf);
+	}
+	if (id < RECSONG) {
+		return packGatePattern(gate.seq[id - RECGATEPATTERN], buf);
 	}
+	if (id == RECSONG) {
+		return packSong(buf);
+	}
+	return presets.packChunk(id - RECBANK, buf);
+}
 
+uint8_t SetupMenu::packSettings(uint8_t *buf) {
+	RecordWriter w(buf, StorageHandler::maxPayload);
+	w.put(editMode == LFO ? 1 : (editMode == NOISE ? 2 : 0));
+	w.put(autoSave);
+	w.put(actionCVType);
+	w.put(actionBtnType);
+	w.put(revEnc);
+	w.put(clock.ppqn);
+	w.put(sequencer.swing);
+	w.put(sequencer.actionStutterNo);
+	for (uint8_t p = 0; p < calibration.calibPoints; p++) {
+		w.put16(calibration.offset[p]);
+	}
+	for (uint8_t u = 0; u < userScaleCount; u++) {
+		w.put16(userScales[u]);
+	}
+	for (uint8_t t = 0; t < TRACKS; t++) {
+		w.put(sequencer.loopFirst[t]);
+		w.put(sequencer.loopLast[t]);
+		w.put(sequencer.ratioMul[t]);
+		w.put(sequencer.ratioDiv[t]);
+		w.put(sequencer.direction[t]);
+	}
+	return w.length();
+}
+
+uint8_t SetupMenu::packSong(uint8_t *buf) {
+	RecordWriter w(buf, StorageHandler::maxPayload);
+	w.put(song.length);
+	w.put(song.active);
+	for (uint8_t e = 0; e < song.length; e++) {
+		w.put(song.entries[e].cvPattern);
+		w.put(song.entries[e].gatePattern);
+		w.put(song.entries[e].repeats);
+		w.put(song.entries[e].transpose);
+	}
+	return w.length();
 }
 
 boolean SetupMenu::loadSettings() {
 
-	if (romRead(0) != 80 || romRead(1) != 68 || romRead(2) != 1) {
+	uint8_t version = romRead(2);
+	if (romRead(0) != 80 || romRead(1) != 68 || (version != 1 && version != 11)) {
 		Serial.println("Read Error - header corrupt");
 		return 0;
 	}
+	if (version == 11) {
+		return loadRecords();
+	}
 
-	cvLoopFirst = romRead(3);		// first sequence in loop
-	cvLoopLast = romRead(4);		// last sequence in loop
-	gateLoopFirst = romRead(5);		// first sequence in loop
-	gateLoopLast = romRead(6);		// last sequence in loop
+	//	version 1 stored settings and 8 step patterns at fixed positions - they are rewritten as records by the next save
+	sequencer.loopFirst[SEQCV] = romRead(3) & 7;		// first sequence in loop
+	sequencer.loopLast[SEQCV] = constrain(romRead(4), sequencer.loopFirst[SEQCV], 7);		// last sequence in loop
+	sequencer.loopFirst[SEQGATE] = romRead(5) & 7;
+	sequencer.loopLast[SEQGATE] = constrain(romRead(6), sequencer.loopFirst[SEQGATE], 7);
 
 	if (romRead(7)) {
 		editMode = LFO;
@@ -273,29 +494,190 @@ boolean SetupMenu::loadSettings() {
 	else if (romRead(8)) {
 		editMode = NOISE;
 	}
-	autoSave = romRead(9);
+	autoSave = romRead(9) > 0;
 	setVal("Autosave", OffOnOpts[autoSave]);
 	setVal("Action CV", actions[actionCVType]);
-	actionBtnType = (actionOpts)romRead(14);
+	uint8_t actionBtn = romRead(14);
+	actionBtnType = (actionOpts)(actionBtn < actionSize ? actionBtn : 0);
 	setVal("Action Btn", actions[actionBtnType]);
-	cvOffset = romRead(16);
-	setVal("CV Calibration", cvOffset);
-	revEnc = romRead(17);
+	calibration.reset((int8_t)romRead(16));		// upgrade single offset calibration by applying offset to all points
+	revEnc = romRead(17) > 0;
 	setVal("Reverse Encoder", OffOnOpts[revEnc]);
 
-	// deserialise cv struct
-	char cvToByte[sizeof(cv)];
-	for (uint16_t b = 0; b < sizeof(cv); b++) {
-		cvToByte[b] = romRead(b + 500);
-	}
-	memcpy(&cv, cvToByte, sizeof(cv));
+	loadLegacyPatterns();
+	return 1;
+}
 
-	// deserialise gate struct
-	char gateToByte[sizeof(gate)];
-	for (uint16_t b = 0; b < sizeof(gate); b++) {
-		gateToByte[b] = romRead(b + 1500);
+boolean SetupMenu::loadRecords() {
+	//	fields beyond the end of a record read as zero so records saved with fewer fields load with defaults
+	saveRecord = -1;		// abandon any save in progress - the records it had yet to write would overwrite those being loaded
+	storage.init();
+	uint8_t buf[StorageHandler::maxPayload];
+	uint8_t len = storage.read(RECSETTINGS, buf);
+	if (len == 0) {
+		Serial.println("Read Error - no settings record");
+		return 0;
+	}
+	if (!loadRecord(RECSETTINGS, buf, len)) {
+		Serial.println("Read Error - settings record not readable");
+		return 0;
 	}
-	memcpy(&gate, gateToByte, sizeof(gate));
+	//	patterns and the song that were never saved keep the values they were initialised with
+	for (uint8_t id = RECCVPATTERN; id <= RECSONG; id++) {
+		len = storage.read(id, buf);
+		if (len > 0) {
+			loadRecord(id, buf, len);
+		}
+	}
+	dirtyRecords = 0;
+	return 1;
+}
 
+boolean SetupMenu::loadRecord(uint8_t id, const uint8_t *buf, uint8_t len) {
+	RecordReader r(buf, len);
+	if (r.format == 0 || r.format > RECORDFORMAT) {
+		return 0;
+	}
+	if (id == RECSETTINGS) {
+		unpackSettings(r);
+	}
+	else if (id < RECSONG) {
+		//	unpacked into a copy first so a playing track never sees a half loaded pattern
+		if (id < RECGATEPATTERN) {
+			CvSequence s;
+			unpackCvPattern(s, r);
+			noInterrupts();
+			cv.seq[id - RECCVPATTERN] = s;
+			interrupts();
+		}
+		else {
+			GateSequence s;
+			unpackGatePattern(s, r);
+			noInterrupts();
+			gate.seq[id - RECGATEPATTERN] = s;
+			interrupts();
+		}
+	}
+	else if (id == RECSONG) {
+		unpackSong(r);
+	}
+	else {
+		return presets.loadChunk(id - RECBANK, buf, len);
+	}
 	return 1;
+}
+
+void SetupMenu::unpackSettings(RecordReader &r) {
+	uint8_t lfoNoise = r.get(2);
+	if (lfoNoise) {
+		editMode = lfoNoise == 1 ? LFO : NOISE;
+	}
+	autoSave = r.get();
+	setVal("Autosave", OffOnOpts[autoSave > 0]);
+	actionCVType = (actionOpts)r.get(actionSize - 1);
+	setVal("Action CV", actions[actionCVType]);
+	actionBtnType = (actionOpts)r.get(actionSize - 1);
+	setVal("Action Btn", actions[actionBtnType]);
+	revEnc = r.get();
+	setVal("Reverse Encoder", OffOnOpts[revEnc > 0]);
+	uint8_t ppqn = r.get();
+	for (uint8_t p = 0; p < ppqnSize; p++) {
+		if (ppqnOpts[p] == ppqn) {
+			clock.ppqn = ppqnOpts[p];
+			setVal("Clock PPQN", ppqnNames[p]);
+		}
+	}
+	sequencer.swing = r.get(swingSize - 1);
+	setVal("Swing", swingNames[sequencer.swing]);
+	uint8_t actionStutterNo = r.get();
+	for (uint8_t a = 0; a < actionStutterSize; a++) {
+		if (actionStutterOpts[a] == actionStutterNo) {
+			sequencer.actionStutterNo = actionStutterNo;
+			setVal("Action Stutter", actionStutterNames[a]);
+		}
+	}
+	for (uint8_t p = 0; p < calibration.calibPoints; p++) {
+		int16_t offset = r.get16();
+		calibration.offset[p] = constrain(offset, -400, 400);
+	}
+	calibration.buildTable();
+	for (uint8_t u = 0; u < userScaleCount; u++) {
+		uint16_t mask = r.get16() & 0xFFF;
+		if (mask) {
+			userScales[u] = mask;
+		}
+	}
+	for (uint8_t t = 0; t < TRACKS; t++) {
+		sequencer.loopFirst[t] = r.get() & 7;
+		uint8_t loopLast = r.get();
+		uint8_t ratioMul = r.get();
+		uint8_t ratioDiv = r.get();
+		sequencer.loopLast[t] = constrain(loopLast, sequencer.loopFirst[t], 7);
+		sequencer.ratioMul[t] = constrain(ratioMul, 1, 8);
+		sequencer.ratioDiv[t] = constrain(ratioDiv, 1, 8);
+		sequencer.direction[t] = r.get(directionSize - 1);
+	}
+}
+
+void SetupMenu::unpackSong(RecordReader &r) {
+	uint8_t length = r.get();
+	song.length = constrain(length, 0, SONGSIZE);
+	song.active = r.get() > 0;
+	setVal("Song Mode", OffOnOpts[song.active]);
+	for (uint8_t e = 0; e < song.length; e++) {
+		song.entries[e].cvPattern = r.get() & 7;
+		song.entries[e].gatePattern = r.get() & 7;
+		uint8_t repeats = r.get();
+		int8_t transpose = r.get();
+		song.entries[e].repeats = constrain(repeats, 0, 16);
+		song.entries[e].transpose = constrain(transpose, -12, 12);
+	}
+	song.compile();
+}
+
+void SetupMenu::loadLegacyPatterns() {
+	// cv structs were stored from position 500 and gate structs from 1500 - convert each 8 step pattern, initialising the steps beyond the first 8
+	for (uint8_t p = 0; p < 8; p++) {
+		LegacyCvSequence old;
+		for (uint16_t b = 0; b < sizeof(old); b++) {
+			((uint8_t*)&old)[b] = romRead(500 + (p * sizeof(old)) + b);
+		}
+		initCvSequence(p, INITBLANK, old.steps);
+		CvSequence &s = cv.seq[p];
+		s.mode = old.mode & 1;
+		s.root = old.root % 12;
+		s.scale = old.scale < scaleSize ? old.scale : 0;
+		s.tuning = 0;
+		s.swing = 0;
+		s.markov = 0;
+		memset(s.nudge, 0, sizeof(s.nudge));
+		s.ratchetCurve = 0;
+		s.ratchetRamp = 0;
+		for (uint8_t i = 0; i < 8; i++) {
+			s.volts[i] = VoltsToCode(old.Steps[i].volts);
+			SetNibble(s.randAmt, i, old.Steps[i].rand_amt > 10 ? 10 : old.Steps[i].rand_amt);
+			SetNibble(s.stutter, i, old.Steps[i].stutter > 15 ? 15 : old.Steps[i].stutter);
+		}
+	}
+
+	for (uint8_t p = 0; p < 8; p++) {
+		LegacyGateSequence old;
+		for (uint16_t b = 0; b < sizeof(old); b++) {
+			((uint8_t*)&old)[b] = romRead(1500 + (p * sizeof(old)) + b);
+		}
+		initGateSequence(p, INITBLANK, old.steps);
+		GateSequence &s = gate.seq[p];
+		s.mode = old.mode & 1;
+		s.swing = 0;
+		s.markov = 0;
+		memset(s.nudge, 0, sizeof(s.nudge));
+		s.ratchetCurve = 0;
+		s.ratchetGate = 0;
+		for (uint8_t i = 0; i < 8; i++) {
+			SetBit(s.on, i, old.Steps[i].on);
+			SetNibble(s.randAmt, i, old.Steps[i].rand_amt > 10 ? 10 : old.Steps[i].rand_amt);
+			// gate stutters alternated the gate on each subdivision - halve them so each former pulse is one ratchet hit at the default 50% length
+			SetNibble(s.stutter, i, old.Steps[i].stutter < 30 ? (old.Steps[i].stutter + 1) / 2 : 15);
+		}
+	}
 }
\ No newline at end of file
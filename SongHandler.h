@@ -0,0 +1,158 @@
+#pragma once
+// Song mode - plays an ordered list of pattern entries instead of each track's loop range
+// Entries are compiled into a playlist with each entry's next position worked out in advance so the sequencer only does a lookup when a pattern wraps
+#include "Settings.h"
+
+class SongHandler {
+public:
+	boolean active;						// true to play the song rather than the tracks' loop ranges
+	uint8_t length;						// number of entries in the song
+	SongEntry entries[SONGSIZE];
+	int8_t editEntry = -1;				// entry being edited from the setup menu - -1 when not editing
+
+	void compile();						// rebuild the playlist from the entries - call after editing
+	void restart();						// play from the first entry - called by the sequencer restart with interrupts off
+	boolean playing() { return active && count > 0; }
+	void nextPass();					// the first CV track has wrapped - move on to the next entry after its repeats
+	uint8_t pattern(seqType type) { return type == SEQCV ? playlist[pos].cvPattern : playlist[pos].gatePattern; }
+	int16_t transpose() { return playlist[pos].transpose; }
+	uint8_t position() { return pos; }
+
+	void startEdit();					// start editing from the setup menu with the first entry selected
+	void editValue(boolean up);			// alter the selected entry or field
+	boolean nextField();				// move to the next field - returns false once editing is finished
+	String editDescription();			// eg '2 Gate:5' for display in the setup menu
+
+private:
+	struct SongStep {
+		uint8_t cvPattern;
+		uint8_t gatePattern;
+		uint8_t repeats;
+		uint8_t next;					// playlist position that follows this one
+		int16_t transpose;				// DAC codes added to the CV tracks
+	};
+	SongStep playlist[SONGSIZE];
+	uint8_t count;						// entries in the playlist
+	volatile uint8_t pos;				// playlist position playing
+	volatile uint8_t passes;			// passes left before moving on
+	uint8_t editField;					// 0 selects the entry; 1 - 4 edit its CV pattern, gate pattern, repeats and transposition
+};
+
+void SongHandler::compile() {
+	//	removed entries are dropped from the song so the playlist only holds entries that play
+	if (length > SONGSIZE) {
+		length = SONGSIZE;
+	}
+	uint8_t n = 0;
+	for (uint8_t e = 0; e < length; e++) {
+		if (entries[e].repeats > 0) {
+			entries[n++] = entries[e];
+		}
+	}
+	length = n;
+
+	noInterrupts();
+	for (uint8_t e = 0; e < length; e++) {
+		playlist[e].cvPattern = entries[e].cvPattern & 7;
+		playlist[e].gatePattern = entries[e].gatePattern & 7;
+		playlist[e].repeats = entries[e].repeats;
+		playlist[e].next = e + 1 < length ? e + 1 : 0;
+		playlist[e].transpose = (int16_t)entries[e].transpose * DACVOLT / 12;
+	}
+	count = length;
+	if (pos >= count) {
+		pos = 0;
+		passes = playlist[0].repeats;
+	}
+	interrupts();
+}
+
+void SongHandler::restart() {
+	pos = 0;
+	passes = playlist[0].repeats;
+}
+
+void SongHandler::nextPass() {
+	if (passes > 1) {
+		passes--;
+	}
+	else {
+		pos = playlist[pos].next;
+		passes = playlist[pos].repeats;
+	}
+}
+
+void SongHandler::startEdit() {
+	editEntry = 0;
+	editField = 0;
+}
+
+void SongHandler::editValue(boolean up) {
+	if (editField == 0) {
+		// choose an entry to edit, 'Add' to append an entry or 'Done' to finish
+		editEntry = constrain(editEntry + (up ? 1 : -1), 0, length + (length < SONGSIZE ? 1 : 0));
+		return;
+	}
+	SongEntry &e = entries[editEntry];
+	switch (editField) {
+	case 1:
+		e.cvPattern = AddNLoop(e.cvPattern, up, 7);
+		break;
+	case 2:
+		e.gatePattern = AddNLoop(e.gatePattern, up, 7);
+		break;
+	case 3:
+		e.repeats = constrain(e.repeats + (up ? 1 : -1), 0, 16);
+		break;
+	case 4:
+		e.transpose = constrain(e.transpose + (up ? 1 : -1), -12, 12);
+		break;
+	}
+}
+
+boolean SongHandler::nextField() {
+	if (editField == 0) {
+		if (editEntry > length || (editEntry == length && length == SONGSIZE)) {
+			compile();
+			editEntry = -1;
+			return 0;
+		}
+		if (editEntry == length) {
+			// new entries start as a copy of the last entry
+			entries[length] = length > 0 ? entries[length - 1] : SongEntry{ 0, 0, 1, 0 };
+			length++;
+		}
+		editField = 1;
+	}
+	else if (editField < 4 && (editField != 3 || entries[editEntry].repeats > 0)) {
+		editField++;
+	}
+	else {
+		// back to choosing an entry - entries with no repeats are removed
+		editField = 0;
+		compile();
+		if (editEntry > length) {
+			editEntry = length;
+		}
+	}
+	return 1;
+}
+
+String SongHandler::editDescription() {
+	if (editField == 0 && editEntry >= length) {
+		return editEntry == length && length < SONGSIZE ? "Add" : "Done";
+	}
+	SongEntry &e = entries[editEntry];
+	String entry = String(editEntry + 1) + " ";
+	switch (editField) {
+	case 1:
+		return entry + "CV:" + String(e.cvPattern + 1);
+	case 2:
+		return entry + "Gate:" + String(e.gatePattern + 1);
+	case 3:
+		return entry + (e.repeats ? "Repeat:" + String(e.repeats) : "Delete");
+	case 4:
+		return entry + "Trans:" + (e.transpose > 0 ? "+" : "") + String(e.transpose);
+	}
+	return entry + "C" + String(e.cvPattern + 1) + " G" + String(e.gatePattern + 1) + " x" + String(e.repeats) + " " + (e.transpose > 0 ? "+" : "") + String(e.transpose);
+}
@@ -0,0 +1,241 @@
+#pragma once
+// Journaled EEPROM store - settings, patterns and the song are saved as records appended to a circular log so writes are spread across the whole EEPROM
+// Each record carries a sequence number and CRC; at boot the newest valid copy of each record is used so a power cut during a save leaves the previous copy in place
+// Records are written a few bytes at a time so a save can be spread over many passes of the main loop
+#include <EEPROM.h>
+#include "Settings.h"
+
+// record ids - one record per pattern so an edit only rewrites the pattern it changed
+enum recordId { RECSETTINGS = 0, RECCVPATTERN = 1, RECGATEPATTERN = 9, RECSONG = 17, RECBANK = 18 };
+enum storeResult { STOREDONE, STOREBUSY, STOREFULL };
+
+class StorageHandler {
+public:
+	static const uint16_t logStart = 4;				// bytes 0 - 3 hold the 'PD' header and settings version
+	static const uint16_t logSize = 2048 - logStart;
+	static const uint8_t maxRecords = RECBANK + BANKS * BANKCHUNKS;
+	static const uint8_t maxPayload = 180;			// largest record - a 64 step CV pattern is at most 173 bytes
+	// the log always keeps room to move the largest record, leaving logSize - maxPayload - 7 = 1857 bytes for the newest copy of every record (7 bytes each on top of the payload)
+	// settings (45), the song (67) and all 16 patterns fit with every pattern up to 48 steps long (CV 132, gate 65 at most) - at 64 steps with a random amount and ratchet
+	// on every step the patterns alone need 2152 bytes, so saves report STOREFULL and keep the previous copy; preset banks only have the space the patterns leave
+
+	StorageHandler();								// starts with no records so reads before init() find nothing
+	void init();									// scan the log for the newest valid copy of each record - call before reading
+	void format();									// forget all records - the log is rewritten from the start
+	uint8_t read(uint8_t id, uint8_t *data);		// copy the newest copy of a record into data (at least maxPayload bytes) and return its length - 0 if not stored
+	storeResult write(uint8_t id, const uint8_t *data, uint8_t len, uint8_t maxBytes);	// append a new copy of a record unless unchanged, changing at most maxBytes EEPROM bytes - call again with the same record while STOREBUSY
+																						// a record written with no data reads as not stored
+	static uint16_t crc(uint16_t crc, uint8_t b);	// add a byte to a CRC-16/CCITT - start from 0xFFFF
+
+private:
+	// record layout: magic, id, sequence number (2 bytes), payload length, payload, CRC16 of id to end of payload (2 bytes)
+	static const uint8_t magic = 0xA5;
+	static const uint8_t overhead = 7;
+	static const uint16_t none = 0xFFFF;
+
+	uint8_t logRead(uint16_t o) { return EEPROM.read(logStart + (o % logSize)); }
+	boolean logWrite(uint16_t o, uint8_t val);
+	uint16_t seqAt(uint16_t o) { return logRead(o + 2) | (logRead(o + 3) << 8); }
+	uint16_t sizeAt(uint16_t o) { return logRead(o + 4) + overhead; }
+	boolean valid(uint16_t o);
+	void startJob(uint8_t id, const uint8_t *data, uint8_t len);
+	boolean continueJob(uint8_t maxBytes);
+	uint16_t freeSpace(uint8_t &tail);
+
+	uint16_t recordPos[maxRecords];		// log offset of the newest copy of each record
+	uint16_t head;						// log offset the next record is written to
+	uint16_t seq;						// sequence number of the next record
+
+	uint8_t job[maxPayload + overhead];	// record being appended - bytes are written in order so the CRC is written last
+	uint8_t jobLen;
+	uint8_t jobPos;						// next byte of the job to write
+	uint16_t jobHead;					// log offset the job is written to
+	int8_t jobId = -1;					// id of the record being appended - -1 if none
+	boolean jobMove;					// job is moving the tail record on to make room
+};
+
+StorageHandler::StorageHandler() {
+	format();
+}
+
+boolean StorageHandler::logWrite(uint16_t o, uint8_t val) {
+	uint16_t pos = logStart + (o % logSize);
+	if (EEPROM.read(pos) != val) {
+		EEPROM.write(pos, val);
+		return 1;
+	}
+	return 0;
+}
+
+uint16_t StorageHandler::crc(uint16_t crc, uint8_t b) {
+	// CRC-16/CCITT - bitwise as records are only checked at boot and after writing
+	crc ^= b << 8;
+	for (uint8_t i = 0; i < 8; i++) {
+		crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+boolean StorageHandler::valid(uint16_t o) {
+	if (logRead(o) != magic || logRead(o + 1) >= maxRecords || logRead(o + 4) > maxPayload) {
+		return 0;
+	}
+	uint16_t c = 0xFFFF;
+	uint16_t end = o + sizeAt(o) - 2;
+	for (uint16_t i = o + 1; i < end; i++) {
+		c = crc(c, logRead(i));
+	}
+	return logRead(end) == (c & 0xFF) && logRead(end + 1) == (c >> 8);
+}
+
+void StorageHandler::init() {
+	//	every offset is checked so records are found even where a newer record has partly overwritten an older one
+	format();
+	boolean found = 0;
+	for (uint16_t o = 0; o < logSize; o++) {
+		if (valid(o)) {
+			uint8_t id = logRead(o + 1);
+			uint16_t s = seqAt(o);
+			if (recordPos[id] == none || (int16_t)(s - seqAt(recordPos[id])) > 0) {
+				recordPos[id] = o;
+			}
+			if (!found || (int16_t)(s - seq) >= 0) {
+				seq = s;
+				head = (o + sizeAt(o)) % logSize;
+				found = 1;
+			}
+			o += sizeAt(o) - 1;
+		}
+	}
+	if (found) {
+		seq++;
+	}
+}
+
+void StorageHandler::format() {
+	for (uint8_t r = 0; r < maxRecords; r++) {
+		recordPos[r] = none;
+	}
+	head = 0;
+	seq = 0;
+	jobId = -1;
+}
+
+uint8_t StorageHandler::read(uint8_t id, uint8_t *data) {
+	//	the record header is checked again so a bad offset can never copy more than maxPayload bytes into data
+	uint16_t o = recordPos[id];
+	if (o == none || logRead(o) != magic || logRead(o + 1) != id) {
+		return 0;
+	}
+	uint8_t len = logRead(o + 4);
+	if (len > maxPayload) {
+		return 0;
+	}
+	for (uint8_t i = 0; i < len; i++) {
+		data[i] = logRead(o + 5 + i);
+	}
+	return len;
+}
+
+uint16_t StorageHandler::freeSpace(uint8_t &tail) {
+	//	free space runs from the head to the oldest live record (the tail) - older copies of records in between are no longer needed
+	uint16_t space = logSize;
+	for (uint8_t r = 0; r < maxRecords; r++) {
+		if (recordPos[r] != none) {
+			uint16_t d = (recordPos[r] + logSize - head) % logSize;
+			if (d < space) {
+				space = d;
+				tail = r;
+			}
+		}
+	}
+	return space;
+}
+
+storeResult StorageHandler::write(uint8_t id, const uint8_t *data, uint8_t len, uint8_t maxBytes) {
+	if (jobId < 0) {
+		//	unchanged records are not written again so a save only wears the EEPROM for records that have been edited
+		uint16_t o = recordPos[id];
+		if (o == none && len == 0) {
+			return STOREDONE;
+		}
+		if (o != none && logRead(o + 4) == len) {
+			uint8_t i = 0;
+			while (i < len && logRead(o + 5 + i) == data[i]) {
+				i++;
+			}
+			if (i == len) {
+				return STOREDONE;
+			}
+		}
+
+		//	always leave room to move the largest record so the tail can be moved on without overwriting a live record
+		uint16_t live = 0;
+		for (uint8_t r = 0; r < maxRecords; r++) {
+			if (recordPos[r] != none) {
+				live += sizeAt(recordPos[r]);
+			}
+		}
+		uint16_t reserve = maxPayload + overhead;
+		if (live + len + overhead + reserve > logSize) {
+			return STOREFULL;
+		}
+
+		//	if there is not yet room move the tail record to the head first - each move frees the space of any older copies behind the tail
+		uint8_t tail = 0;
+		if (freeSpace(tail) < len + overhead + reserve) {
+			uint8_t buf[maxPayload];
+			startJob(tail, buf, read(tail, buf));
+			jobMove = 1;
+		}
+		else {
+			startJob(id, data, len);
+			jobMove = 0;
+		}
+	}
+
+	if (!continueJob(maxBytes) || jobMove) {
+		return STOREBUSY;
+	}
+	return STOREDONE;
+}
+
+void StorageHandler::startJob(uint8_t id, const uint8_t *data, uint8_t len) {
+	uint16_t c = 0xFFFF;
+	job[0] = magic;
+	job[1] = id;
+	job[2] = seq & 0xFF;
+	job[3] = seq >> 8;
+	job[4] = len;
+	for (uint8_t i = 0; i < len; i++) {
+		job[5 + i] = data[i];
+	}
+	for (uint8_t i = 1; i < len + 5; i++) {
+		c = crc(c, job[i]);
+	}
+	job[5 + len] = c & 0xFF;
+	job[6 + len] = c >> 8;
+
+	jobId = id;
+	jobLen = len + overhead;
+	jobPos = 0;
+	jobHead = head;
+	seq++;
+}
+
+boolean StorageHandler::continueJob(uint8_t maxBytes) {
+	//	bytes already holding the right value cost a read but do not count towards maxBytes
+	while (jobPos < jobLen && maxBytes > 0) {
+		if (logWrite(jobHead + jobPos, job[jobPos])) {
+			maxBytes--;
+		}
+		jobPos++;
+	}
+	if (jobPos < jobLen) {
+		return 0;
+	}
+	recordPos[jobId] = jobHead;
+	head = (jobHead + jobLen) % logSize;
+	jobId = -1;
+	return 1;
+}
@@ -0,0 +1,149 @@
+// Random history lock - plays patterns with random values, ratchets and random walk and Markov playback, locks them and checks every later pass
+// outputs exactly the same events at the same points in the pass
+#include <stdio.h>
+#include <vector>
+#include "Settings.h"
+
+uint16_t userScales[userScaleCount];
+CvPatterns cv;
+GatePatterns gate;
+uint32_t dirtyRecords;
+void setDirty(uint8_t record) { dirtyRecords |= 1UL << record; }
+
+// fixed seed so every run plays the same steps
+uint32_t randState = 1;
+double getRand() {
+	randState ^= randState << 13;
+	randState ^= randState >> 17;
+	randState ^= randState << 5;
+	return (double)randState / 4294967296.0;
+}
+
+int16_t getRandLimit(uint8_t seqNo, uint8_t step, rndType getUpper) {
+	int16_t range = GetNibble(cv.seq[seqNo].randAmt, step) * (DACVOLT / 2);
+	return cv.seq[seqNo].volts[step] + (getUpper == UPPER ? range : -range);
+}
+
+#include "Sequencer.h"
+
+QuantiseHandler quantiser;
+GeneratorHandler generator;
+HistoryHandler history;
+SongHandler song;
+StorageHandler storage;
+PresetHandler presets;
+Sequencer sequencer;
+
+uint32_t failures = 0;
+
+void check(boolean ok, const char *what, uint32_t n = 0) {
+	if (!ok && failures++ < 10) {
+		printf("  %s (%u)\n", what, n);
+	}
+}
+
+// 16 step patterns with random amounts on every step and ratchets on every third - pattern 0 of each type plays in random walk or Markov order, pattern 1 forward
+void makePatterns() {
+	for (uint8_t p = 0; p < 2; p++) {
+		cv.seq[p].steps = 16;
+		cv.seq[p].mode = PITCH;
+		cv.seq[p].ratchetRamp = p;
+		gate.seq[p].steps = 16;
+		gate.seq[p].markov = 0b11100111;
+		for (uint8_t s = 0; s < MAXSTEPS; s++) {
+			cv.seq[p].volts[s] = getRand() * 4095;
+			SetNibble(cv.seq[p].randAmt, s, 1 + (uint8_t)(getRand() * 5));
+			SetNibble(cv.seq[p].stutter, s, s % 3 == 0 ? 3 : 0);
+			SetBit(gate.seq[p].on, s, getRand() < 0.6);
+			SetNibble(gate.seq[p].randAmt, s, 3 + (uint8_t)(getRand() * 6));
+			SetNibble(gate.seq[p].stutter, s, s % 3 == 1 ? 4 : 0);
+		}
+		quantiser.makeTable(p, cv.seq[p].root, cv.seq[p].scale, cv.seq[p].tuning);
+	}
+	sequencer.direction[0] = DIRWALK;
+	sequencer.direction[1] = DIRMARKOV;
+	sequencer.seqNo[2] = 1;
+	sequencer.seqNo[3] = 1;
+	sequencer.makeMarkovTables();
+}
+
+// events due in the next pass of the patterns, timed from the start of the pass - the sequencer timer interrupt runs every 100us with preroll() from loop() every millisecond
+// a pass is not a whole number of interrupts so events belong to the pass they fall due in, which may be before the interrupt sending them
+const uint32_t passMicros = 16 * STEPTICKS * (uint32_t)(60000000 / (120 * MASTERPPQN));
+uint32_t passStart = 0;
+std::vector<SeqEvent> played;
+
+std::vector<SeqEvent> playPass() {
+	uint32_t from = passStart;
+	passStart += passMicros;
+	SeqEvent e;
+	for (; (int32_t)(hostMicros - passStart) < 100; hostMicros += 100) {
+		if (hostMicros % 1000 == 0) {
+			sequencer.preroll();
+		}
+		sequencer.tick(hostMicros);
+		while (sequencer.getEvent(hostMicros, e)) {
+			played.push_back(e);
+		}
+	}
+
+	std::vector<SeqEvent> pass;
+	for (SeqEvent e : played) {
+		if (e.time - from < passMicros) {
+			e.time -= from;
+			pass.push_back(e);
+		}
+	}
+	return pass;
+}
+
+boolean samePass(const std::vector<SeqEvent> &a, const std::vector<SeqEvent> &b) {
+	if (a.size() != b.size()) {
+		return 0;
+	}
+	for (size_t i = 0; i < a.size(); i++) {
+		if (a[i].type != b[i].type || a[i].track != b[i].track || a[i].value != b[i].value || a[i].time != b[i].time) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int main() {
+	makePatterns();
+	sequencer.setTempo(120, 0);
+	hostMicros = 1000000;
+	passStart = hostMicros;
+
+	//	unlocked, every pass rolls again
+	playPass();
+	std::vector<SeqEvent> first = playPass();
+	std::vector<SeqEvent> second = playPass();
+	check(!samePass(first, second), "unlocked: passes repeat");
+
+	//	locked with no mutate chance - the pass after the lock takes effect repeats exactly
+	for (uint8_t type = SEQCV; type <= SEQGATE; type++) {
+		for (uint8_t p = 0; p < 2; p++) {
+			history.toggleLock(type, p);
+		}
+	}
+	playPass();
+	std::vector<SeqEvent> locked = playPass();
+	for (uint8_t n = 0; n < 4; n++) {
+		check(samePass(playPass(), locked), "locked: pass differs", n);
+	}
+	printf("locked random history, %u events a pass: %s\n", (uint32_t)locked.size(), failures == 0 ? "ok" : "FAILED");
+
+	//	a high mutate chance rolls again
+	uint32_t checked = failures;
+	history.mutate[SEQGATE][0] = 9;
+	playPass();
+	check(!samePass(playPass(), locked), "mutate: locked pass repeats");
+	printf("mutate while locked: %s\n", failures == checked ? "ok" : "FAILED");
+
+	if (failures) {
+		printf("%u failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
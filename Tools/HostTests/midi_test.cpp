@@ -0,0 +1,208 @@
+// USB-MIDI end to end - MIDI clock and transport go in through the usbMIDI stand-in, the sequencer timer interrupt and loop() are run as the firmware runs them,
+// and the notes and controllers sent back are checked against the clock
+#define USB_MIDI_SERIAL			// Teensy USB Type Serial + MIDI
+#include <stdio.h>
+#include "Settings.h"
+
+uint16_t userScales[userScaleCount];
+CvPatterns cv;
+GatePatterns gate;
+uint32_t dirtyRecords;
+void setDirty(uint8_t record) { dirtyRecords |= 1UL << record; }
+double getRand() { return 0; }
+int16_t getRandLimit(uint8_t seqNo, uint8_t step, rndType) { return cv.seq[seqNo].volts[step]; }
+float bpm = 120;
+
+#include "MidiHandler.h"
+
+QuantiseHandler quantiser;
+GeneratorHandler generator;
+HistoryHandler history;
+SongHandler song;
+StorageHandler storage;
+PresetHandler presets;
+InputHandler inputs;
+ClockHandler clock(35, 300);
+Sequencer sequencer;
+MidiHandler midi;
+
+uint32_t failures = 0;
+
+void check(boolean ok, const char *what, int32_t n = 0) {
+	if (!ok && failures++ < 10) {
+		printf("  %s (%d)\n", what, n);
+	}
+}
+
+// the sequencer timer interrupt every 100us and loop(), with MIDI clock arriving at bpm from the time given until the end
+// transport messages arrive at the times given in the script
+// loop() is modelled as its two longest stretches: reading inputs and drawing the display frame, then sending the frame to the display
+// send() runs at the top of loop() and between the two, so a message queued by the interrupt waits at most the longer stretch plus one interrupt period
+// the stretch lengths are a slow frame - a full display update and a busy edit screen - not measurements; a longer frame raises the bound by the same amount
+const uint32_t drawMicros = 3000;
+const uint32_t transferMicros = 2000;
+const uint32_t jitterMicros = max(drawMicros, transferMicros) + 100;
+uint32_t loopAt = 0;
+boolean drawn = 0;
+struct Transport {
+	uint32_t time;
+	uint8_t status;
+};
+uint32_t clockAt(uint32_t start, float clockBPM, uint32_t n) { return start + (uint32_t)(n * 60000000.0 / (clockBPM * MIDIPPQN)); }
+
+void run(uint32_t until, uint32_t clockStart, float clockBPM, const Transport *script = nullptr, uint8_t scriptLen = 0) {
+	uint32_t n = 0;
+	while (clockAt(clockStart, clockBPM, n) < hostMicros) {
+		n++;
+	}
+	uint8_t s = 0;
+	for (; hostMicros < until; hostMicros += 100) {
+		while (s < scriptLen && script[s].time <= hostMicros) {
+			usbMIDI.arrive(script[s++].status);
+		}
+		while (clockAt(clockStart, clockBPM, n) <= hostMicros) {
+			usbMIDI.arrive(0xF8);
+			n++;
+		}
+
+		//	sequencerTimer()
+		midi.receive();
+		sequencer.tick(hostMicros);
+		SeqEvent e;
+		while (sequencer.getEvent(hostMicros, e)) {
+			midi.output(e);
+		}
+
+		//	loop()
+		if ((int32_t)(hostMicros - loopAt) >= 0) {
+			midi.send();
+			if (drawn) {
+				loopAt += transferMicros;
+			}
+			else {
+				InputEvent i;
+				while (inputs.get(i)) {
+					if (i.type == INPUTCLOCK) {
+						clock.countPulse(i.time);
+					}
+				}
+				float clockBPM = clock.readClock();
+				if (clockBPM >= 35 && clockBPM < 300 && clock.hasSignal()) {
+					bpm = clockBPM;
+				}
+				sequencer.setTempo(bpm, clock.hasSignal());
+				sequencer.preroll();
+				loopAt += drawMicros;
+			}
+			drawn = !drawn;
+		}
+	}
+}
+
+// messages sent between the times given with the status (ignoring the channel) and channel given
+uint32_t countSent(uint32_t from, uint32_t to, uint8_t status, uint8_t channel, uint8_t *first = nullptr) {
+	uint32_t n = 0;
+	for (auto &m : usbMIDI.sent) {
+		if (m.time >= from && m.time < to && m.status == (status | channel)) {
+			if (n++ == 0 && first) {
+				*first = m.data1;
+			}
+		}
+	}
+	return n;
+}
+
+// every note turned on by a channel before the time given has been turned off
+boolean notesOff(uint8_t channel, uint32_t to) {
+	int8_t on[128] = {};
+	for (auto &m : usbMIDI.sent) {
+		if (m.time < to && (m.status & 0xF) == channel) {
+			if ((m.status & 0xF0) == 0x90) {
+				on[m.data1]++;
+			}
+			if ((m.status & 0xF0) == 0x80) {
+				on[m.data1]--;
+			}
+		}
+	}
+	for (int8_t c : on) {
+		if (c != 0) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+int main() {
+	//	8 step patterns: pitch mode CV rising a semitone a step, gates on every other step; CV pattern 1 in CV mode for the second CV track
+	for (uint8_t p = 0; p < 8; p++) {
+		cv.seq[p].steps = 8;
+		cv.seq[p].mode = PITCH;
+		gate.seq[p].steps = 8;
+		for (uint8_t s = 0; s < MAXSTEPS; s++) {
+			cv.seq[p].volts[s] = round(s * DACVOLT / 12.0);
+			SetBit(gate.seq[p].on, s, s % 2 == 0);
+		}
+		quantiser.makeTable(p, 0, 0, 0);
+	}
+	cv.seq[1].mode = CV;
+	sequencer.seqNo[3] = 1;
+	sequencer.makeMarkovTables();
+	midi.begin();
+
+	//	MIDI start then clock at 130 bpm - the sequencer follows the clock with a step every 12 pulses (eighth notes)
+	const float clockBPM = 130;
+	const uint32_t start = 1000000;
+	const uint32_t stepMicros = 60000000 / (clockBPM * 2);
+	Transport play[] = { { start - 5000, 0xFA } };
+	run(start + 4000000, start, clockBPM, play, 1);
+	float readBPM = clock.readClock();
+	check(clock.hasSignal() && fabs(readBPM - clockBPM) < 0.5, "clock: bpm not followed", readBPM * 10);
+	uint32_t steps = 4000000 / stepMicros + 1;
+	uint8_t firstNote = 0;
+	uint32_t notes = countSent(start, start + 4000000, 0x90, 0, &firstNote);
+	check(notes >= steps - 1 && notes <= steps, "clock: CV note count", notes);
+	check(firstNote == MIDICVNOTE, "clock: first note after start not step 1", firstNote);
+	uint32_t gateNotes = countSent(start, start + 4000000, 0x90, 1);
+	check(gateNotes >= steps / 2 - 1 && gateNotes <= steps / 2 + 1, "clock: gate note count", gateNotes);
+	check(countSent(start, start + 4000000, 0xB0, 3) > 0, "clock: no controllers from CV mode track", 0);
+
+	//	each gate note is sent by the next call to send() after the clock pulse its step falls on
+	uint32_t worst = 0;
+	for (auto &m : usbMIDI.sent) {
+		if (m.status == 0x91 && m.time >= start) {
+			uint32_t pulse = (uint32_t)round((m.time - start) / (double)stepMicros) * 12;
+			uint32_t late = m.time - clockAt(start, clockBPM, pulse);
+			worst = max(worst, late);
+		}
+	}
+	check(worst <= jitterMicros, "clock: gate note later than the longest stretch of loop() (us)", worst);
+	printf("MIDI clock in at %.0f bpm: read %.2f bpm, %u CV notes for %u steps, gate notes at most %u us after their clock (bound %u us): %s\n",
+		clockBPM, readBPM, notes, steps, worst, jitterMicros, failures == 0 ? "ok" : "FAILED");
+
+	//	MIDI stop with the clock still running - all notes end and no more are played, then continue carries on
+	uint32_t checked = failures;
+	uint32_t stop = hostMicros + 10000;
+	Transport stopCont[] = { { stop, 0xFC }, { stop + 1000000, 0xFB } };
+	run(stop + 2000000, start, clockBPM, stopCont, 2);
+	for (uint8_t t = 0; t < TRACKS; t++) {
+		check(notesOff(t, stop + 5000), "stop: note left on, channel", t + 1);
+		check(countSent(stop + 5000, stop + 1000000, 0x90, t) == 0, "stop: note played while stopped, channel", t + 1);
+	}
+	check(countSent(stop + 1000000, stop + 2000000, 0x90, 0) >= steps / 4 - 1, "continue: CV notes", countSent(stop + 1000000, stop + 2000000, 0x90, 0));
+	printf("MIDI stop and continue: %s\n", failures == checked ? "ok" : "FAILED");
+
+	//	MIDI start again plays from the first step
+	checked = failures;
+	uint32_t restart = hostMicros + 10000;
+	Transport again[] = { { restart, 0xFA } };
+	run(restart + 500000, start, clockBPM, again, 1);
+	check(countSent(restart, restart + 500000, 0x90, 0, &firstNote) > 0 && firstNote == MIDICVNOTE, "start: first note not step 1", firstNote);
+	printf("MIDI start: %s\n", failures == checked ? "ok" : "FAILED");
+
+	if (failures) {
+		printf("%u failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,211 @@
+// Quantiser lookup table - checks the table against the float quantiser it replaced and against the nearest note of every tuning, then times both
+#include <stdio.h>
+#include <chrono>
+#include "Settings.h"
+
+uint16_t userScales[userScaleCount] = { 0xAB5, 0x4A9 };
+
+#include "QuantiseHandler.h"
+
+// The quantiser before the lookup table: a search of up to 12 boundaries in the octave for every output, five built in scales, 12-EDO only
+namespace old {
+	boolean scaleNotes[5][12] = { { 1,1,1,1,1,1,1,1,1,1,1,1 }, { 1,0,1,0,1,1,0,1,0,1,0,1 }, { 1,0,0,1,0,1,0,1,0,0,1,0 }, { 1,0,1,1,0,1,0,1,1,0,0,1 }, { 1,0,1,1,0,1,0,1,0,1,0,1 } };
+	uint8_t newScales[5] = { 0, 1, 2, 3, 4 };		// position of each old scale in scaleMasks
+
+	struct QuantiseRange {
+		float to;
+		float target;
+	};
+	QuantiseRange quantiseRange[12];
+
+	void makeQuantiseArray(uint8_t root, uint8_t scale) {
+		uint8_t lookupPos = 0, s = 0;
+		float targCurr, targPrev = 0, toPrev = 0;
+		for (uint8_t n = 0; n < 28; n++) {
+			if (scaleNotes[scale][n % 12]) {
+				targCurr = 0.083333 * (n + root);
+				if (lookupPos > 0) {
+					toPrev = targPrev + ((targCurr - targPrev) / 2);
+				}
+				if (toPrev > 1 && s < 12) {
+					quantiseRange[s].target = constrain(targPrev - (float)1, 0, 5);
+					quantiseRange[s].to = toPrev - (float)1;
+					s++;
+				}
+				targPrev = targCurr;
+				lookupPos++;
+			}
+		}
+	}
+
+	float quantiseVolts(float v, uint8_t scale) {
+		if (scale == 0) {
+			return (float)round(v * 12) / 12;
+		}
+		float v1 = v - int(v);
+		for (uint8_t x = 0; x < 12; x++) {
+			if (v1 <= quantiseRange[x].to) {
+				return int(v) + quantiseRange[x].target;
+			}
+		}
+		return v;
+	}
+
+	// DAC code of the note before it was limited to the DAC range
+	int32_t quantise(uint16_t code, uint8_t scale) {
+		return round(quantiseVolts((float)code / DACVOLT, scale) * DACVOLT);
+	}
+
+	boolean isNote(int32_t code, uint8_t root, uint8_t scale) {
+		int32_t semitone = round(code / (DACVOLT / 12.0));
+		return abs(code - semitone * (DACVOLT / 12.0)) <= 1 && scaleNotes[scale][(semitone - root + 120) % 12];
+	}
+}
+
+QuantiseHandler quantiser;
+uint32_t failures = 0;
+
+void fail(const char *what, uint8_t root, uint16_t mask, uint8_t tuning, uint16_t code, int32_t got, int32_t want) {
+	if (failures++ < 10) {
+		printf("  %s root %d mask %03x tuning %d code %d: got %d want %d\n", what, root, mask, tuning, code, got, want);
+	}
+}
+
+// every code for every root of the old scales gives the old note - the old note frequencies were rounded to 0.083333V so allow one code
+// a code exactly halfway between two notes may go to either, as the old float boundaries fell either side of the halfway point
+void checkOld() {
+	uint32_t checked = failures;
+	uint32_t ties = 0, offScale = 0;
+	for (uint8_t s = 0; s < 5; s++) {
+		for (uint8_t r = 0; r < 12; r++) {
+			old::makeQuantiseArray(r, s);
+			quantiser.makeTable(0, r, old::newScales[s], 0);
+			for (uint16_t c = 0; c < 4096; c++) {
+				int32_t note = old::quantise(c, s);
+				int32_t want = constrain(note, 0, 4095);
+				int32_t got = quantiser.quantise(0, c);
+				if (abs(got - want) <= 1) {
+					continue;
+				}
+				// the old search clamped notes below the octave to the start of the octave, giving a note that may not be in the scale - the nearest note check covers these codes
+				if (!old::isNote(note, r, s)) {
+					offScale++;
+					continue;
+				}
+				// a tie if the old note's mirror image about the code is also a scale note
+				int32_t mirror = (2 * c) - note;
+				if (old::isNote(mirror, r, s) && abs(got - constrain(mirror, 0, 4095)) <= 1) {
+					ties++;
+				}
+				else {
+					fail("old", r, scaleMasks[s], 0, c, got, want);
+				}
+			}
+		}
+	}
+	printf("old quantiser, 5 scales x 12 roots x 4096 codes: %s (%u ties, %u old notes off the scale)\n", failures == checked ? "ok" : "FAILED", ties, offScale);
+}
+
+// every code goes to a note of the tuning and there is no nearer note - pitches are worked out here in double precision, so allow one code
+void checkNearest(uint8_t root, uint16_t mask, uint8_t tuning) {
+	const Tuning &t = tunings[tuning];
+	double notes[maxDegrees * 9];
+	uint16_t n = 0;
+	for (int8_t o = -2; o <= 6; o++) {
+		for (uint8_t d = 0; d < t.degrees; d++) {
+			if (t.degrees == 12 && ((mask >> d) & 1) == 0) {
+				continue;
+			}
+			double octaves = t.ratios ? log2((double)t.ratios[d * 2] / t.ratios[d * 2 + 1]) : (double)d / t.degrees;
+			notes[n++] = (o + root / 12.0 + octaves) * DACVOLT;
+		}
+	}
+	quantiser.makeTable(0, root, userScaleFirst, tuning);
+	for (uint16_t c = 0; c < 4096; c++) {
+		int32_t got = quantiser.quantise(0, c);
+		double nearest = notes[0];
+		for (uint16_t i = 0; i < n; i++) {
+			if (fabs(notes[i] - c) < fabs(nearest - c)) {
+				nearest = notes[i];
+			}
+		}
+		// any note as near as the nearest will do, and notes outside the DAC range come out at the end of the range
+		boolean found = 0;
+		for (uint16_t i = 0; i < n; i++) {
+			if (fabs(notes[i] - c) <= fabs(nearest - c) + 1 && fabs(constrain(notes[i], 0.0, 4095.0) - got) <= 1) {
+				found = 1;
+			}
+		}
+		if (!found) {
+			fail("nearest", root, mask, tuning, c, got, (int32_t)round(constrain(nearest, 0.0, 4095.0)));
+		}
+	}
+}
+
+void checkAllNearest() {
+	uint32_t checked = failures;
+	for (uint8_t tuning = 0; tuning < tuningSize; tuning++) {
+		for (uint8_t r = 0; r < 12; r++) {
+			for (uint8_t s = 0; s < userScaleFirst; s++) {
+				userScales[0] = scaleMasks[s];
+				checkNearest(r, scaleMasks[s], tuning);
+			}
+			// single note scales leave the widest gaps between notes
+			for (uint8_t d = 0; d < 12; d++) {
+				userScales[0] = 1 << d;
+				checkNearest(r, 1 << d, tuning);
+			}
+		}
+	}
+	printf("nearest note, %d tunings x 12 roots x %d scales and 12 single notes: %s\n", tuningSize, userScaleFirst, failures == checked ? "ok" : "FAILED");
+
+	checked = failures;
+	for (uint16_t mask = 1; mask < 0x1000; mask++) {
+		userScales[0] = mask;
+		checkNearest(0, mask, 0);
+	}
+	printf("nearest note, every 12-EDO note mask: %s\n", failures == checked ? "ok" : "FAILED");
+}
+
+// time a quantise of every DAC code in the major scale, and rebuilding the table
+void benchmark() {
+	const uint16_t reps = 2000;
+	volatile uint32_t sink = 0;
+	old::makeQuantiseArray(0, 1);
+	quantiser.makeTable(0, 0, 1, 0);
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint16_t r = 0; r < reps; r++) {
+		for (uint16_t c = 0; c < 4096; c++) {
+			sink = sink + old::quantise(c, 1);
+		}
+	}
+	double oldNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (reps * 4096.0);
+
+	start = std::chrono::steady_clock::now();
+	for (uint16_t r = 0; r < reps; r++) {
+		for (uint16_t c = 0; c < 4096; c++) {
+			sink = sink + quantiser.quantise(0, c);
+		}
+	}
+	double tableNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (reps * 4096.0);
+
+	start = std::chrono::steady_clock::now();
+	for (uint16_t r = 0; r < reps / 10; r++) {
+		quantiser.makeTable(0, r % 12, 1 + r % 2, 0);
+	}
+	double makeUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / (reps / 10);
+
+	printf("benchmark (host): old search %.1f ns, table %.1f ns per quantise (%.1fx); table rebuild %.1f us\n", oldNs, tableNs, oldNs / tableNs, makeUs);
+}
+
+int main() {
+	checkAllNearest();
+	checkOld();
+	benchmark();
+	if (failures) {
+		printf("%u failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
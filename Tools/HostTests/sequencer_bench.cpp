@@ -0,0 +1,126 @@
+// Sequencer engine benchmark - runs the engine with no hardware, feeding it simulated time and draining its output events as the sequencer timer interrupt does
+#include <stdio.h>
+#include <chrono>
+#include "Settings.h"
+
+uint16_t userScales[userScaleCount];
+CvPatterns cv;
+GatePatterns gate;
+uint32_t dirtyRecords;
+void setDirty(uint8_t record) { dirtyRecords |= 1UL << record; }
+
+// fixed seed so every run plays the same steps
+uint32_t randState = 1;
+double getRand() {
+	randState ^= randState << 13;
+	randState ^= randState >> 17;
+	randState ^= randState << 5;
+	return (double)randState / 4294967296.0;
+}
+
+int16_t getRandLimit(uint8_t seqNo, uint8_t step, rndType getUpper) {
+	int16_t range = GetNibble(cv.seq[seqNo].randAmt, step) * (DACVOLT / 2);
+	return cv.seq[seqNo].volts[step] + (getUpper == UPPER ? range : -range);
+}
+
+#include "Sequencer.h"
+
+QuantiseHandler quantiser;
+GeneratorHandler generator;
+HistoryHandler history;
+SongHandler song;
+StorageHandler storage;
+PresetHandler presets;
+
+// 16 step pitched CV patterns and gate patterns with random amounts and the odd ratchet - every step does the work a played pattern does
+void makePatterns() {
+	for (uint8_t p = 0; p < 8; p++) {
+		cv.seq[p].steps = 16;
+		cv.seq[p].mode = PITCH;
+		cv.seq[p].scale = 1;
+		gate.seq[p].steps = 16;
+		for (uint8_t s = 0; s < MAXSTEPS; s++) {
+			cv.seq[p].volts[s] = getRand() * 4095;
+			SetNibble(cv.seq[p].randAmt, s, (uint8_t)(getRand() * 4));
+			SetNibble(cv.seq[p].stutter, s, s % 5 == 0 ? 3 : 0);
+			SetBit(gate.seq[p].on, s, getRand() < 0.7);
+			SetNibble(gate.seq[p].randAmt, s, (uint8_t)(getRand() * 4));
+			SetNibble(gate.seq[p].stutter, s, s % 7 == 0 ? 2 : 0);
+		}
+		quantiser.makeTable(p, cv.seq[p].root, cv.seq[p].scale, cv.seq[p].tuning);
+	}
+}
+
+double seconds(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// master ticks as fast as the engine can process them - each call to tick() is given the time of the next master tick
+// every track is set to the same clock ratio and direction; returns nanoseconds per master tick
+double flatOut(const char *name, uint8_t mul, uint8_t div, seqDirection dir) {
+	const float bpm = 120;
+	const uint32_t tickMicros = 60000000 / (bpm * MASTERPPQN);
+	const uint32_t ticks = 2000000;		// nearly three hours of playing, so the time also wraps as micros() does after 71 minutes
+	Sequencer seq = Sequencer();		// value initialised so it starts zeroed like the firmware's global
+	for (uint8_t t = 0; t < TRACKS; t++) {
+		seq.ratioMul[t] = mul;
+		seq.ratioDiv[t] = div;
+		seq.direction[t] = dir;
+	}
+	seq.setTempo(bpm, 0);
+	seq.makeMarkovTables();
+	uint32_t events = 0;
+	SeqEvent e;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 1; i <= ticks; i++) {
+		uint32_t now = i * tickMicros;
+		seq.preroll();
+		seq.tick(now);
+		while (seq.getEvent(now, e)) {
+			events++;
+		}
+	}
+	double ns = seconds(start) * 1e9 / ticks;
+	printf("flat out, %-16s %6.2f million master ticks per second, %3.0f ns per tick, %3.0f ns per track, %u events (%u dropped)\n", name, 1000 / ns, ns, ns / TRACKS, events, seq.droppedEvents);
+	return ns;
+}
+
+// the sequencer timer interrupt every 100us at 120 bpm, with preroll() from loop() every millisecond
+void timerInterrupt() {
+	const uint32_t interval = 100;
+	const uint32_t calls = 6000000;		// ten minutes of playing
+	Sequencer seq = Sequencer();
+	seq.setTempo(120, 0);
+	seq.makeMarkovTables();
+	SeqEvent e;
+	uint32_t events = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 1; i <= calls; i++) {
+		uint32_t now = i * interval;
+		if (i % 10 == 0) {
+			seq.preroll();
+		}
+		seq.tick(now);
+		while (seq.getEvent(now, e)) {
+			events++;
+		}
+	}
+	double s = seconds(start);
+	printf("timer interrupt: %.0f ns per call at 120 bpm, %u events in %u minutes\n", s * 1e9 / calls, events, calls * interval / 60000000);
+}
+
+int main() {
+	makePatterns();
+	printf("benchmark (host), %d tracks\n", TRACKS);
+	// the cost of each track grows with the steps it plays - a track at 4:1 plays four steps in the time of one base step
+	flatOut("1:1 forward", 1, 1, DIRFORWARD);
+	flatOut("4:1 forward", 4, 1, DIRFORWARD);
+	flatOut("1:4 forward", 1, 4, DIRFORWARD);
+	flatOut("3:2 pendulum", 3, 2, DIRPENDULUM);
+	flatOut("1:1 random walk", 1, 1, DIRWALK);
+	flatOut("1:1 Markov", 1, 1, DIRMARKOV);
+	timerInterrupt();
+	return 0;
+}
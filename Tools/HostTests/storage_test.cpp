@@ -0,0 +1,275 @@
+// Journaled EEPROM store - runs the store against a simulated EEPROM that counts the writes to each cell
+// Checks a new part, records read back after every save, recovery from a power cut part way through any save, compaction and damaged records,
+// the largest working set of settings, patterns and song, then compares the wear of a long run of edits with saving each record at a fixed address
+#include <stdio.h>
+#include <vector>
+#include "Settings.h"
+#include "StorageHandler.h"
+#include "RecordFormat.h"
+
+uint32_t failures = 0;
+
+void check(boolean ok, const char *what, uint32_t n = 0) {
+	if (!ok && failures++ < 10) {
+		printf("  %s (%u)\n", what, n);
+	}
+}
+
+uint32_t randState = 1;
+uint32_t random(uint32_t limit) {
+	randState ^= randState << 13;
+	randState ^= randState >> 17;
+	randState ^= randState << 5;
+	return randState % limit;
+}
+
+// the record contents the store should hold - empty if not stored
+std::vector<uint8_t> model[StorageHandler::maxRecords];
+
+std::vector<uint8_t> readRecord(StorageHandler &st, uint8_t id) {
+	uint8_t buf[StorageHandler::maxPayload];
+	uint8_t len = st.read(id, buf);
+	return std::vector<uint8_t>(buf, buf + len);
+}
+
+boolean matchesModel(StorageHandler &st) {
+	for (uint8_t id = 0; id < StorageHandler::maxRecords; id++) {
+		if (readRecord(st, id) != model[id]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+// save a record a few bytes at a time as the main loop does - stops after steps calls to write() to simulate a power cut
+storeResult save(StorageHandler &st, uint8_t id, const std::vector<uint8_t> &data, uint32_t steps = 0xFFFFFFFF) {
+	storeResult r;
+	do {
+		if (steps-- == 0) {
+			return STOREBUSY;
+		}
+		r = st.write(id, data.data(), data.size(), 4);
+	} while (r == STOREBUSY);
+	return r;
+}
+
+// record sizes like those the firmware saves: settings, CV and gate patterns of 8 to 32 steps, the song
+std::vector<uint8_t> newContents(uint8_t id) {
+	uint8_t len = id == RECSETTINGS ? 40 : (id < RECGATEPATTERN ? 40 + random(60) : (id < RECSONG ? 20 + random(30) : 66));
+	std::vector<uint8_t> data(len);
+	for (uint8_t &b : data) {
+		b = random(256);
+	}
+	return data;
+}
+
+void checkNewPart() {
+	uint32_t checked = failures;
+	EEPROM.erase();
+	StorageHandler st = StorageHandler();
+	for (uint8_t id = 0; id < StorageHandler::maxRecords; id++) {
+		check(readRecord(st, id).empty(), "new part: record found before init", id);
+	}
+	st.init();
+	for (uint8_t id = 0; id < StorageHandler::maxRecords; id++) {
+		check(readRecord(st, id).empty(), "new part: record found", id);
+	}
+	model[RECSETTINGS] = newContents(RECSETTINGS);
+	check(save(st, RECSETTINGS, model[RECSETTINGS]) == STOREDONE, "new part: save failed");
+	StorageHandler boot = StorageHandler();
+	boot.init();
+	check(matchesModel(boot), "new part: record not read back after boot");
+	printf("new part (all 0xFF): %s\n", failures == checked ? "ok" : "FAILED");
+}
+
+// a damaged record is never copied out, however long its length byte says it is
+void checkDamaged() {
+	uint32_t checked = failures;
+	const uint8_t guard = 16;
+	uint8_t buf[StorageHandler::maxPayload + guard];
+	EEPROM.erase();
+	StorageHandler st = StorageHandler();
+	st.init();
+	std::vector<uint8_t> data = newContents(RECSETTINGS);
+	save(st, RECSETTINGS, data);		// the first record is written at the start of the log
+
+	const uint16_t first = StorageHandler::logStart;
+	uint8_t damage[][2] = { { 4, 0xFF }, { 4, StorageHandler::maxPayload + 1 }, { 0, 0x00 }, { 1, RECSONG } };		// length, magic and id bytes
+	for (auto &d : damage) {
+		uint8_t was = EEPROM.cells[first + d[0]];
+		EEPROM.cells[first + d[0]] = d[1];
+		memset(buf, 0xEE, sizeof(buf));
+		check(st.read(RECSETTINGS, buf) == 0, "damaged: record read", d[0]);
+		for (uint8_t i = StorageHandler::maxPayload; i < sizeof(buf); i++) {
+			check(buf[i] == 0xEE, "damaged: read past maxPayload", d[0]);
+		}
+		StorageHandler boot = StorageHandler();
+		boot.init();
+		check(boot.read(RECSETTINGS, buf) == 0, "damaged: record found at boot", d[0]);
+		EEPROM.cells[first + d[0]] = was;
+	}
+	printf("damaged records: %s\n", failures == checked ? "ok" : "FAILED");
+}
+
+// every pattern with a random amount and ratchet on every step, saved as the autosave does with settings and a full song - returns the saves that were full
+// every record saved reads back after boot and a record that did not fit keeps its previous copy
+uint32_t saveWorstCase(uint8_t steps) {
+	EEPROM.erase();
+	StorageHandler st = StorageHandler();
+	st.init();
+	uint32_t full = 0;
+	for (uint8_t id = 0; id <= RECSONG; id++) {
+		model[id].clear();
+		uint8_t buf[StorageHandler::maxPayload];
+		uint8_t len = 45;				// settings - mode bytes, calibration, user scales and track options
+		if (id == RECSONG) {
+			len = 3 + SONGSIZE * 4;
+		}
+		else if (id >= RECGATEPATTERN) {
+			GateSequence g = {};
+			g.steps = steps;
+			memset(g.on, 0xFF, sizeof(g.on));
+			memset(g.randAmt, 0x99, sizeof(g.randAmt));
+			memset(g.stutter, 0xFF, sizeof(g.stutter));
+			len = packGatePattern(g, buf);
+		}
+		else if (id >= RECCVPATTERN) {
+			CvSequence c = {};
+			c.steps = steps;
+			memset(c.volts, 0xFF, sizeof(c.volts));
+			memset(c.randAmt, 0x99, sizeof(c.randAmt));
+			memset(c.stutter, 0xFF, sizeof(c.stutter));
+			len = packCvPattern(c, buf);
+		}
+		std::vector<uint8_t> data(buf, buf + len);
+		if (id == RECSETTINGS || id == RECSONG) {
+			for (uint8_t &b : data) {
+				b = random(256);
+			}
+		}
+		if (save(st, id, data) == STOREFULL) {
+			full++;
+			continue;
+		}
+		model[id] = data;
+	}
+	StorageHandler boot = StorageHandler();
+	boot.init();
+	check(matchesModel(boot), "worst case: records not found at boot", steps);
+	return full;
+}
+
+void checkWorstCase() {
+	uint32_t checked = failures;
+	uint32_t full48 = saveWorstCase(48);
+	check(full48 == 0, "worst case: 48 step patterns do not fit", full48);
+	uint32_t full64 = saveWorstCase(64);
+	check(full64 > 0, "worst case: 64 step patterns fit - update the limit at maxPayload", full64);
+	printf("largest working set: fits at 48 steps, %u of 18 records full at 64 steps: %s\n", full64, failures == checked ? "ok" : "FAILED");
+}
+
+struct Save {
+	uint8_t id;
+	std::vector<uint8_t> data;
+};
+
+// random edits of random records, each saved as the autosave does; one save in four is cut off part way and the store is booted again
+// the saves that completed are added to workload
+void checkEdits(uint32_t edits, std::vector<Save> &workload) {
+	uint32_t checked = failures;
+	uint32_t cuts = 0, full = 0, appended = 0;
+	EEPROM.erase();
+	for (auto &m : model) {
+		m.clear();
+	}
+	StorageHandler st = StorageHandler();
+	st.init();
+	for (uint8_t id = 0; id <= RECSONG; id++) {
+		model[id] = newContents(id);
+		save(st, id, model[id]);
+		workload.push_back({ id, model[id] });
+	}
+
+	for (uint32_t e = 0; e < edits; e++) {
+		uint8_t id = random(RECSONG + 1);
+		std::vector<uint8_t> data = newContents(id);
+		if (random(4) == 0) {
+			//	power cut - the record is either the old or the new copy and every other record is untouched
+			save(st, id, data, random(80));
+			cuts++;
+			st = StorageHandler();
+			st.init();
+			std::vector<uint8_t> got = readRecord(st, id);
+			check(got == model[id] || got == data, "power cut: record is neither copy", e);
+			model[id] = got;
+			check(matchesModel(st), "power cut: other records changed", e);
+			continue;
+		}
+		if (save(st, id, data) == STOREFULL) {
+			full++;
+			continue;
+		}
+		model[id] = data;
+		workload.push_back({ id, data });
+		appended += data.size() + 7;
+		check(matchesModel(st), "edit: records not read back", e);
+		if (e % 100 == 0) {
+			StorageHandler boot = StorageHandler();
+			boot.init();
+			check(matchesModel(boot), "edit: records not found at boot", e);
+		}
+	}
+	check(full == 0, "edit: store full", full);
+	printf("%u edits with %u power cuts, log wrapped %u times: %s\n", edits, cuts, appended / StorageHandler::logSize, failures == checked ? "ok" : "FAILED");
+}
+
+uint32_t mostWritten() {
+	uint32_t worst = 0;
+	for (uint16_t i = 0; i < EEPROM.length(); i++) {
+		worst = max(worst, EEPROM.writes[i]);
+	}
+	return worst;
+}
+
+// the most written cell after the same saves to the journal and to a fixed address for each record, changing only the bytes that differ as the old saveSettings() did
+// returns how many times more the fixed address cell was written
+double compareWear(const char *name, const std::vector<Save> &workload) {
+	EEPROM.erase();
+	StorageHandler st = StorageHandler();
+	st.init();
+	for (const Save &w : workload) {
+		save(st, w.id, w.data);
+	}
+	uint32_t journal = mostWritten();
+
+	EEPROM.erase();
+	for (const Save &w : workload) {
+		for (uint8_t i = 0; i < w.data.size(); i++) {
+			EEPROM.update(w.id * 100 + i, w.data[i]);		// records in this test are at most 99 bytes
+		}
+	}
+	uint32_t fixed = mostWritten();
+	printf("wear, %s, %u saves: most written cell journal %u, fixed address %u (%.1fx)\n", name, (uint32_t)workload.size(), journal, fixed, (double)fixed / journal);
+	return (double)fixed / journal;
+}
+
+int main() {
+	checkNewPart();
+	checkDamaged();
+	checkWorstCase();
+	std::vector<Save> workload;
+	checkEdits(20000, workload);
+	compareWear("random records", workload);
+
+	//	editing one pattern with autosave on rewrites the same record over and over
+	workload.clear();
+	for (uint32_t s = 0; s < 10000; s++) {
+		workload.push_back({ RECCVPATTERN, newContents(RECCVPATTERN) });
+	}
+	check(compareWear("one pattern", workload) > 10, "wear: journal not spreading the writes of one record");
+	if (failures) {
+		printf("%u failures\n", failures);
+		return 1;
+	}
+	return 0;
+}
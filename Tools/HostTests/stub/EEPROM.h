@@ -0,0 +1,16 @@
+#pragma once
+// Host stand-in for the Teensy EEPROM library - 2048 bytes, erased to 0xFF like a new part, counting the writes to each cell
+#include <stdint.h>
+#include <string.h>
+
+struct HostEEPROM {
+	uint8_t cells[2048];
+	uint32_t writes[2048];
+	HostEEPROM() { erase(); }
+	void erase() { memset(cells, 0xFF, sizeof(cells)); memset(writes, 0, sizeof(writes)); }
+	uint8_t read(int pos) { return cells[pos]; }
+	void write(int pos, uint8_t val) { cells[pos] = val; writes[pos]++; }
+	void update(int pos, uint8_t val) { if (cells[pos] != val) write(pos, val); }
+	uint16_t length() { return sizeof(cells); }
+};
+inline HostEEPROM EEPROM;
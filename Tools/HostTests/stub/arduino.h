@@ -0,0 +1,77 @@
+#pragma once
+// Host stand-in for the parts of the Arduino and Teensy core used by the handlers under test
+// Time only moves when a test sets hostMicros, so runs are repeatable; interrupts are simulated by the test calling the interrupt routines itself
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define FALLING 2
+#define DEC 10
+#define HEX 16
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+template<class T> T min(T a, T b) { return a < b ? a : b; }
+template<class T> T max(T a, T b) { return a > b ? a : b; }
+inline long map(long x, long inLow, long inHigh, long outLow, long outHigh) { return (x - inLow) * (outHigh - outLow) / (inHigh - inLow) + outLow; }
+
+inline uint32_t hostMicros = 0;
+inline uint32_t micros() { return hostMicros; }
+inline uint32_t millis() { return hostMicros / 1000; }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+class String {
+public:
+	String() {}
+	String(const char *c) : s(c) {}
+	String(const std::string &c) : s(c) {}
+	String(char c) : s(1, c) {}
+	String(int v, int base = DEC) : s(base == HEX ? hex(v) : std::to_string(v)) {}
+	String(unsigned v, int base = DEC) : s(base == HEX ? hex(v) : std::to_string(v)) {}
+	String(long v) : s(std::to_string(v)) {}
+	String(unsigned long v) : s(std::to_string(v)) {}
+	String(double v, int decimals = 2) : s(fixed(v, decimals)) {}
+	String operator+(const String &o) const { return String(s + o.s); }
+	friend String operator+(const char *a, const String &b) { return String(std::string(a) + b.s); }
+	String &operator+=(const String &o) { s += o.s; return *this; }
+	bool operator==(const String &o) const { return s == o.s; }
+	bool operator!=(const String &o) const { return s != o.s; }
+	unsigned length() const { return s.size(); }
+	const char *c_str() const { return s.c_str(); }
+	char operator[](unsigned i) const { return s[i]; }
+	int toInt() const { return atoi(s.c_str()); }
+	std::string s;
+
+private:
+	static std::string hex(unsigned v) { char b[12]; snprintf(b, sizeof(b), "%x", v); return b; }
+	static std::string fixed(double v, int decimals) { char b[32]; snprintf(b, sizeof(b), "%.*f", decimals, v); return b; }
+};
+
+// debug text is dropped; the binary serial protocol is not exercised by the host tests
+struct HostSerial {
+	template<class T> void print(T) {}
+	template<class T> void print(T, int) {}
+	template<class T> void println(T) {}
+	template<class T> void println(T, int) {}
+	void println() {}
+	int available() { return 0; }
+	int read() { return -1; }
+	int availableForWrite() { return 64; }
+	size_t write(const uint8_t *, size_t n) { return n; }
+};
+inline HostSerial Serial;
+
+#if defined(USB_MIDI_SERIAL) || defined(USB_MIDI)
+#include "usb_midi.h"
+#endif
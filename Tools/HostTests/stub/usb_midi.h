@@ -0,0 +1,43 @@
+#pragma once
+// Host stand-in for the Teensy usbMIDI object - tests put incoming messages in with arrive() and find the messages the firmware sent in sent
+#include <stdint.h>
+#include <vector>
+
+class HostUsbMidi {
+public:
+	struct Message {
+		uint8_t status;			// message type with the channel (0 - 15) in the low nibble
+		uint8_t data1;
+		uint8_t data2;
+		uint32_t time;			// hostMicros when the message was sent
+	};
+
+	// firmware side - the same calls as the Teensy usbMIDI object
+	void setHandleRealTimeSystem(void (*handler)(uint8_t)) { realTime = handler; }
+	bool read() {
+		//	one message per call as on the Teensy - real time messages go to their handler, others are read and ignored
+		if (in.empty()) {
+			return 0;
+		}
+		Message m = in.front();
+		in.erase(in.begin());
+		if (m.status >= 0xF8 && realTime) {
+			realTime(m.status);
+		}
+		return 1;
+	}
+	void sendNoteOn(uint8_t note, uint8_t velocity, uint8_t channel) { sent.push_back({ (uint8_t)(0x90 | (channel - 1)), note, velocity, hostMicros }); }
+	void sendNoteOff(uint8_t note, uint8_t velocity, uint8_t channel) { sent.push_back({ (uint8_t)(0x80 | (channel - 1)), note, velocity, hostMicros }); }
+	void sendControlChange(uint8_t control, uint8_t value, uint8_t channel) { sent.push_back({ (uint8_t)(0xB0 | (channel - 1)), control, value, hostMicros }); }
+	void send_now() { flushes++; }
+
+	// test side
+	void arrive(uint8_t status, uint8_t data1 = 0, uint8_t data2 = 0) { in.push_back({ status, data1, data2, hostMicros }); }
+	std::vector<Message> sent;
+	uint32_t flushes = 0;
+
+private:
+	void (*realTime)(uint8_t) = nullptr;
+	std::vector<Message> in;
+};
+inline HostUsbMidi usbMIDI;
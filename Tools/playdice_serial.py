@@ -0,0 +1,161 @@
+#!/usr/bin/env python3
+# Host side of the PlayDice USB serial protocol (SerialHandler.h) - dump and load records, edit steps, monitor steps and telemetry
+# Frame: 0x7E, payload length, frame type, payload, CRC-16/CCITT of length, type and payload (low byte first)
+# Uses the serial device as a plain file so it runs against the Teensy or a pseudo-terminal with no extra packages
+#
+#	playdice_serial.py PORT info
+#	playdice_serial.py PORT get ID
+#	playdice_serial.py PORT dump FILE
+#	playdice_serial.py PORT load FILE
+#	playdice_serial.py PORT edit cv|gate PATTERN STEP volts|rand|stutter VALUE
+#	playdice_serial.py PORT monitor [steps|telemetry|all]
+#	playdice_serial.py PORT save
+
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+
+SYNC = 0x7E
+MAXPAYLOAD = 181		# largest record and its id
+PING, INFO, GET, RECORD, PUT, EDIT, SAVE, STREAM, STEP, TELEMETRY, ACK, NAK = range(1, 13)
+
+
+def crc16(data, crc=0xFFFF):
+	# CRC-16/CCITT as StorageHandler::crc
+	for b in data:
+		crc ^= b << 8
+		for _ in range(8):
+			crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+			crc &= 0xFFFF
+	return crc
+
+
+class Link:
+	def __init__(self, port):
+		self.fd = os.open(port, os.O_RDWR | os.O_NOCTTY)
+		if os.isatty(self.fd):
+			tty.setraw(self.fd)
+			termios.tcflush(self.fd, termios.TCIFLUSH)
+		self.rx = bytearray()
+
+	def send(self, ftype, payload=b""):
+		body = bytes([len(payload), ftype]) + bytes(payload)
+		os.write(self.fd, bytes([SYNC]) + body + struct.pack("<H", crc16(body)))
+
+	def receive(self, timeout=1.0):
+		# returns (type, payload) of the next good frame - debug text and damaged frames are skipped
+		end = time.time() + timeout
+		while True:
+			while len(self.rx) >= 5:
+				start = self.rx.find(SYNC)
+				if start < 0:
+					self.rx.clear()
+					break
+				del self.rx[:start]
+				length = self.rx[1]
+				if length > MAXPAYLOAD:
+					del self.rx[:1]
+					continue
+				if len(self.rx) < length + 5:
+					break
+				body = bytes(self.rx[1:length + 3])
+				if struct.unpack("<H", self.rx[length + 3:length + 5])[0] == crc16(body):
+					del self.rx[:length + 5]
+					return body[1], body[2:]
+				del self.rx[:1]
+			wait = end - time.time()
+			if wait <= 0 or not select.select([self.fd], [], [], wait)[0]:
+				return None, None
+			self.rx += os.read(self.fd, 256)
+
+	def request(self, ftype, payload=b"", expect=(ACK, NAK)):
+		self.send(ftype, payload)
+		while True:
+			rtype, data = self.receive()
+			if rtype is None:
+				sys.exit("No reply")
+			if rtype in expect:
+				return rtype, data
+
+
+def info(link):
+	_, data = link.request(PING, expect=(INFO,))
+	return dict(zip(("format", "records", "bank", "banks", "chunks"), data))
+
+
+def dump(link, path):
+	# file holds each non-empty record as id, length, record
+	count = info(link)["records"]
+	with open(path, "wb") as f:
+		for rid in range(count):
+			_, data = link.request(GET, bytes([rid]), expect=(RECORD, NAK))
+			if len(data) > 1:
+				f.write(bytes([rid, len(data) - 1]) + data[1:])
+	print("Dumped", count, "records to", path)
+
+
+def load(link, path):
+	# bank chunks are sent in id order so each bank starts from its first chunk
+	with open(path, "rb") as f:
+		raw = f.read()
+	n = 0
+	while n + 2 <= len(raw):
+		rid, length = raw[n], raw[n + 1]
+		rtype, _ = link.request(PUT, raw[n:n + 1] + raw[n + 2:n + 2 + length])
+		print("Record", rid, "loaded" if rtype == ACK else "refused")
+		n += length + 2
+
+
+def edit(link, args):
+	kind, pattern, step, field, value = args
+	payload = bytes([("cv", "gate").index(kind), int(pattern), int(step), ("volts", "rand", "stutter").index(field)]) + struct.pack("<H", int(value))
+	rtype, _ = link.request(EDIT, payload)
+	print("Edited" if rtype == ACK else "Refused")
+
+
+def monitor(link, what):
+	link.request(STREAM, bytes([{"steps": 1, "telemetry": 2, "all": 3}[what]]))
+	try:
+		while True:
+			rtype, data = link.receive(timeout=5)
+			if rtype == STEP:
+				t, p, s, v = struct.unpack("<BBBH", data)
+				print("track", t + 1, "pattern", p + 1, "step", s + 1, "value", v)
+			elif rtype == TELEMETRY:
+				tenths, flags, pos, dirty = struct.unpack("<HBBB", data)
+				print("bpm %.1f" % (tenths / 10), "clocked" if flags & 1 else "", "paused" if flags & 2 else "", "song %d" % pos if flags & 4 else "", "saving" if flags & 8 else "", "events dropped" if flags & 16 else "", "unsaved", dirty)
+	except KeyboardInterrupt:
+		link.request(STREAM, bytes([0]))
+
+
+def main():
+	if len(sys.argv) < 3:
+		sys.exit("usage: playdice_serial.py PORT info|get|dump|load|edit|monitor|save [arguments]")
+	link = Link(sys.argv[1])
+	cmd, args = sys.argv[2], sys.argv[3:]
+	if cmd == "info":
+		print(info(link))
+	elif cmd == "get":
+		_, data = link.request(GET, bytes([int(args[0])]), expect=(RECORD, NAK))
+		print(data[1:].hex())
+	elif cmd == "dump":
+		dump(link, args[0])
+	elif cmd == "load":
+		load(link, args[0])
+	elif cmd == "edit":
+		edit(link, args)
+	elif cmd == "monitor":
+		monitor(link, args[0] if args else "all")
+	elif cmd == "save":
+		rtype, _ = link.request(SAVE)
+		print("Saving" if rtype == ACK else "Refused")
+	else:
+		sys.exit("Unknown command " + cmd)
+
+
+if __name__ == "__main__":
+	main()
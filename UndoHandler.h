@@ -0,0 +1,130 @@
+#pragma once
+// Undo and redo of pattern edits - each edit is journaled as the bytes of the pattern it changed (offset, old value, new value) in a fixed size ring
+// Encoder clicks on the same pattern, field and step run together as one edit; the oldest edits are dropped to make room for new ones
+// Entry layout: change count, seqType and pattern, count x (offset, old, new), change count again so the ring can be walked in both directions
+#include "Settings.h"
+#include "StorageHandler.h"
+
+extern CvPatterns cv;
+extern GatePatterns gate;
+extern void setDirty(uint8_t record);
+
+class UndoHandler {
+public:
+	void record(uint8_t type, uint8_t p, uint16_t key);	// call before changing pattern p of seqType type - key identifies the field and step being edited
+	void commit();								// journal the changes since the edit started - later edits start a new entry
+	int8_t undo();								// reverse the last edit - returns the storage record id of the pattern changed or -1 if none
+	int8_t redo();								// repeat the last edit undone
+
+private:
+	static const uint16_t journalSize = 1024;
+	static const uint16_t editTimeout = 2000;	// milliseconds between clicks of the same edit
+	uint8_t *pattern(uint8_t type, uint8_t p) { return type == SEQCV ? (uint8_t *)&cv.seq[p] : (uint8_t *)&gate.seq[p]; }
+	uint8_t patternSize(uint8_t type) { return type == SEQCV ? sizeof(CvSequence) : sizeof(GateSequence); }
+	uint8_t &at(uint16_t i) { return journal[i % journalSize]; }
+	int8_t apply(uint16_t entry, boolean forward);
+
+	uint8_t journal[journalSize];
+	uint16_t first;							// position of the oldest entry
+	uint16_t undoBytes;						// bytes of entries that can be undone, from first
+	uint16_t redoBytes;						// bytes of entries that can be redone, following those that can be undone
+
+	boolean open;							// an edit is in progress
+	uint8_t openType;
+	uint8_t openPattern;
+	uint16_t openKey;
+	uint32_t lastRecord;
+	uint8_t before[sizeof(CvSequence) > sizeof(GateSequence) ? sizeof(CvSequence) : sizeof(GateSequence)];		// pattern as it was when the edit started
+};
+
+void UndoHandler::record(uint8_t type, uint8_t p, uint16_t key) {
+	if (open && (type != openType || p != openPattern || key != openKey || millis() - lastRecord > editTimeout)) {
+		commit();
+	}
+	if (!open) {
+		memcpy(before, pattern(type, p), patternSize(type));
+		openType = type;
+		openPattern = p;
+		openKey = key;
+		open = 1;
+	}
+	lastRecord = millis();
+}
+
+void UndoHandler::commit() {
+	if (!open) {
+		return;
+	}
+	open = 0;
+	const uint8_t *now = pattern(openType, openPattern);
+	uint8_t size = patternSize(openType);
+	uint8_t count = 0;
+	for (uint8_t i = 0; i < size; i++) {
+		count += before[i] != now[i];
+	}
+	uint16_t len = count * 3 + 3;
+	if (count == 0 || len > journalSize) {
+		return;
+	}
+
+	//	a new edit replaces anything that could be redone, then the oldest entries make room
+	redoBytes = 0;
+	while (undoBytes + len > journalSize) {
+		uint16_t oldest = at(first) * 3 + 3;
+		first = (first + oldest) % journalSize;
+		undoBytes -= oldest;
+	}
+	uint16_t n = first + undoBytes;
+	at(n++) = count;
+	at(n++) = (openType << 3) | openPattern;
+	for (uint8_t i = 0; i < size; i++) {
+		if (before[i] != now[i]) {
+			at(n++) = i;
+			at(n++) = before[i];
+			at(n++) = now[i];
+		}
+	}
+	at(n) = count;
+	undoBytes += len;
+}
+
+int8_t UndoHandler::undo() {
+	commit();
+	if (undoBytes == 0) {
+		return -1;
+	}
+	uint16_t len = at(first + undoBytes - 1) * 3 + 3;
+	undoBytes -= len;
+	redoBytes += len;
+	return apply(first + undoBytes, 0);
+}
+
+int8_t UndoHandler::redo() {
+	commit();
+	if (redoBytes == 0) {
+		return -1;
+	}
+	uint16_t entry = first + undoBytes;
+	uint16_t len = at(entry) * 3 + 3;
+	undoBytes += len;
+	redoBytes -= len;
+	return apply(entry, 1);
+}
+
+int8_t UndoHandler::apply(uint16_t entry, boolean forward) {
+	//	written with interrupts off so a playing track never reads half of a two byte step value
+	uint8_t count = at(entry);
+	uint8_t type = at(entry + 1) >> 3;
+	uint8_t p = at(entry + 1) & 7;
+	uint8_t *s = pattern(type, p);
+	noInterrupts();
+	for (uint16_t i = 0; i < count; i++) {
+		uint16_t c = entry + 2 + i * 3;
+		s[at(c)] = at(c + (forward ? 2 : 1));
+	}
+	interrupts();
+
+	int8_t id = (type == SEQCV ? RECCVPATTERN : RECGATEPATTERN) + p;
+	setDirty(id);
+	return id;
+}